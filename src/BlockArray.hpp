@@ -303,6 +303,23 @@ class BlockArray {
             return vals;
         }
 
+        // Number of blocks up to and including the one at idx, the size
+        // of get_leading_vals(idx) without copying the ECs out
+        size_t num_leading(size_t idx) const {
+            if (flag == 1) {
+                return 1;
+            } else if (flag == 2) {
+                return std::upper_bound(poly.begin(), poly.end(), idx,
+                    [](size_t i, const block<T>& b) { return i < b.lb; }) - poly.begin();
+            }
+            return 0;
+        }
+
+        // EC of the i-th block
+        const T& val_at(size_t i) const {
+            return (flag == 2) ? poly[i].val : mono.val;
+        }
+
         std::pair<uint32_t, uint32_t> get_block_at(size_t idx) const {
             if (flag == 1) {
                 return std::make_pair(mono.lb, mono.ub);
@@ -361,6 +378,18 @@ class BlockArray {
             }
         }
 
+        // Calls f on the value of every block
+        template<typename F>
+        void for_each_val(F f) {
+            if (flag == 1) {
+                f(mono.val);
+            } else if (flag == 2) {
+                for (auto& b : poly) {
+                    f(b.val);
+                }
+            }
+        }
+
         typename std::vector<block<T> >::iterator begin() {
             return poly.begin();
         }
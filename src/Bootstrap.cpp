@@ -3,9 +3,12 @@
 
 EMAlgorithm Bootstrap::run_em() {
     auto counts = mult_.sample();
-    EMAlgorithm em(counts, index_, tc_, mean_fls_, opt);
+    // start from uniform, not from em_main's estimate: a replicate started
+    // there barely moves along the directions the reads can't resolve, and
+    // the variance of those targets collapses
+    EMAlgorithm em(counts, em_main_);
+    em.set_num_threads(em_threads_);
 
-    //em.set_start(em_start);
     em.run(10000, 50, false, false);
     /* em.compute_rho(); */
 
@@ -17,22 +20,18 @@ BootstrapThreadPool::BootstrapThreadPool(
     std::vector<size_t> seeds,
     const std::vector<uint32_t>& true_counts,
     const KmerIndex& index,
-    const MinCollector& tc,
-    const std::vector<double>& eff_lens,
+    const EMAlgorithm& em_main,
     const ProgramOptions& p_opts,
-    BootstrapWriter  *bswriter,
-    const std::vector<double>& mean_fls
+    BootstrapWriter  *bswriter
     ) :
   n_threads_(n_threads),
   seeds_(seeds),
   n_complete_(0),
   true_counts_(true_counts),
   index_(index),
-  tc_(tc),
-  eff_lens_(eff_lens),
+  em_main_(em_main),
   opt_(p_opts),
-  writer_(bswriter),
-  mean_fls_(mean_fls)
+  writer_(bswriter)
 {
   for (size_t i = 0; i < n_threads_; ++i) {
     threads_.push_back( std::thread(BootstrapWorker(*this, i)) );
@@ -67,11 +66,9 @@ void BootstrapWorker::operator() (){
     } // release lock
 
     Bootstrap bs(pool_.true_counts_,
-        pool_.index_,
-        pool_.tc_,
-        pool_.eff_lens_,
+        pool_.em_main_,
         cur_seed,
-        pool_.mean_fls_, pool_.opt_);
+        pool_.opt_, 1);
 
     auto res = bs.run_em();
 
@@ -86,7 +83,7 @@ void BootstrapWorker::operator() (){
       plaintext_writer(pool_.opt_.output + "/bs_abundance_" +
           std::to_string(cur_id) + ".tsv",
           pool_.index_.target_names_, res.alpha_,
-          pool_.eff_lens_, pool_.index_.target_lens_);
+          pool_.em_main_.eff_lens_, pool_.index_.target_lens_);
     }
   }
 }
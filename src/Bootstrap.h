@@ -13,24 +13,19 @@
 class Bootstrap {
     // needs:
     // - "true" counts
-    // - ecmap
-    // - target_names
-    // - eff_lens
+    // - the EM run on the true counts, which provides the ecmap,
+    //   target_names, eff_lens and weights
 public:
   Bootstrap(const std::vector<uint32_t>& true_counts,
-            const KmerIndex& index,
-            const MinCollector& tc,
-            const std::vector<double>& eff_lens,
+            const EMAlgorithm& em_main,
             size_t seed,
-            const std::vector<double>& mean_fls,
-            const ProgramOptions& opt) :
-    index_(index),
-    tc_(tc),
-    eff_lens_(eff_lens),
+            const ProgramOptions& opt,
+            int em_threads = 1) :
+    em_main_(em_main),
     seed_(seed),
     mult_(true_counts, seed_),
-    mean_fls_(mean_fls),
-    opt(opt)
+    opt(opt),
+    em_threads_(em_threads)
     {}
 
   // EM Algorithm generates a sample from the Multinomial, then returns
@@ -39,13 +34,11 @@ public:
   EMAlgorithm run_em();
 
 private:
-  const KmerIndex& index_;
-  const MinCollector& tc_;
-  const std::vector<double>& eff_lens_;
+  const EMAlgorithm& em_main_;
   size_t seed_;
   Multinomial mult_;
-  const std::vector<double>& mean_fls_;
   const ProgramOptions& opt;
+  int em_threads_; // threads for the EM itself, 1 when bootstraps run in parallel
 };
 
 class BootstrapWriter {
@@ -72,11 +65,9 @@ class BootstrapThreadPool {
         std::vector<size_t> seeds,
         const std::vector<uint32_t>& true_counts,
         const KmerIndex& index,
-        const MinCollector& tc,
-        const std::vector<double>& eff_lens,
+        const EMAlgorithm& em_main,
         const ProgramOptions& p_opts,
-        BootstrapWriter *bswriter,
-        const std::vector<double>& mean_fls
+        BootstrapWriter *bswriter
         );
 
     size_t num_threads() {return n_threads_;}
@@ -95,11 +86,9 @@ class BootstrapThreadPool {
     // things to run bootstrap
     const std::vector<uint32_t> true_counts_;
     const KmerIndex& index_;
-    const MinCollector& tc_;
-    const std::vector<double>& eff_lens_;
+    const EMAlgorithm& em_main_;
     const ProgramOptions& opt_;
     BootstrapWriter *writer_;
-    const std::vector<double>& mean_fls_;
 };
 
 class BootstrapWorker {
@@ -0,0 +1,207 @@
+#ifndef KALLISTO_CONCURRENT_ECMAP_HPP
+#define KALLISTO_CONCURRENT_ECMAP_HPP
+
+#include <atomic>
+#include <cassert>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "KmerIndex.h"
+
+// Insert-only EC dictionary shared by the read processing threads.
+//
+// Each table is open addressing with a bounded linear probe window. A
+// slot is claimed exactly once, by CAS of its tag (high fingerprint bits,
+// never zero) from zero, and is never cleared. A key is only placed in the
+// next table once its whole probe window in the current one is occupied by
+// other keys. Since occupied slots stay occupied, every thread that probes
+// for the same key walks the same chain of tables, so no key can end up in
+// two places. The tables double in size along the chain.
+//
+// The tag, id and key pointer all live in the slot, so probing past other
+// keys never leaves the table; the key itself is only compared on a tag
+// match. The claiming thread publishes the id (handed out by an atomic
+// counter, so ids stay dense) and key right after its CAS; a reader that
+// finds a claimed slot without them spins for the few instructions that
+// takes.
+class ConcurrentEcMap {
+public:
+  // Sized so that expected keys fit the first table
+  explicit ConcurrentEcMap(size_t expected = 1ULL<<16) : head_(new Table(capacity_for(expected))), next_id_(0), n_adopted_(0) {}
+
+  ~ConcurrentEcMap() {
+    Table* t = head_;
+    while (t != nullptr) {
+      Table* next = t->next.load(std::memory_order_relaxed);
+      for (size_t i = 0; i <= t->mask; i++) {
+        if (t->slots[i].id.load(std::memory_order_relaxed) >= n_adopted_) {
+          delete t->slots[i].key.load(std::memory_order_relaxed);
+        }
+      }
+      delete t;
+      t = next;
+    }
+  }
+
+  ConcurrentEcMap(const ConcurrentEcMap&) = delete;
+  ConcurrentEcMap& operator=(const ConcurrentEcMap&) = delete;
+
+  // Returns the id of u, or -1 if it has not been inserted.
+  int32_t find(const Roaring& u) const {
+    const uint64_t h = ec_fingerprint(u);
+    const uint32_t tag = tag_of(h);
+    const uint32_t card = u.cardinality();
+    for (const Table* t = head_; t != nullptr; t = t->next.load(std::memory_order_acquire)) {
+      const size_t w = window(t);
+      for (size_t i = 0; i < w; i++) {
+        const Slot& slot = t->slots[(h + i) & t->mask];
+        const uint32_t st = slot.tag.load(std::memory_order_acquire);
+        if (st == 0) {
+          return -1;
+        }
+        if (st == tag) {
+          int32_t id = wait_id(slot);
+          if (matches(slot, h, card, u)) {
+            return id;
+          }
+        }
+      }
+    }
+    return -1;
+  }
+
+  // Returns the id of u, inserting a copy of it under the next free id if
+  // absent.
+  int32_t insert(const Roaring& u) {
+    const uint64_t h = ec_fingerprint(u);
+    return insert(u, h, u.cardinality(), nullptr);
+  }
+
+  // Inserts key, which is not copied and has to stay in place for as long
+  // as the map is used, and returns its id. Only call before any insert(),
+  // from a single thread.
+  int32_t adopt(const ECKey& key) {
+    assert(next_id_.load(std::memory_order_relaxed) == n_adopted_);
+    int32_t id = insert(key.ec, key.fingerprint, key.card, &key);
+    n_adopted_ = next_id_.load(std::memory_order_relaxed);
+    return id;
+  }
+
+  // Number of ids handed out so far.
+  size_t size() const {
+    return next_id_.load(std::memory_order_acquire);
+  }
+
+  // All EC keys indexed by id. Only call once the inserting threads are done.
+  std::vector<const ECKey*> ecs() const {
+    std::vector<const ECKey*> v(size(), nullptr);
+    for (const Table* t = head_; t != nullptr; t = t->next.load(std::memory_order_acquire)) {
+      for (size_t i = 0; i <= t->mask; i++) {
+        if (t->slots[i].tag.load(std::memory_order_acquire) != 0) {
+          v[wait_id(t->slots[i])] = t->slots[i].key.load(std::memory_order_acquire);
+        }
+      }
+    }
+    return v;
+  }
+
+private:
+  struct Slot {
+    std::atomic<uint32_t> tag;
+    std::atomic<int32_t> id; // -1 until published
+    std::atomic<const ECKey*> key;
+  };
+
+  struct Table {
+    explicit Table(size_t capacity) : mask(capacity-1), slots(new Slot[capacity]), next(nullptr) {
+      for (size_t i = 0; i < capacity; i++) {
+        slots[i].tag.store(0, std::memory_order_relaxed);
+        slots[i].id.store(-1, std::memory_order_relaxed);
+        slots[i].key.store(nullptr, std::memory_order_relaxed);
+      }
+    }
+    ~Table() { delete[] slots; }
+    const size_t mask; // capacity is a power of two
+    Slot* slots;
+    std::atomic<Table*> next;
+  };
+
+  static const size_t max_probe = 32;
+
+  // keeps the first table at most two thirds full
+  static size_t capacity_for(size_t expected) {
+    size_t capacity = 1;
+    while (capacity < expected + expected/2) {
+      capacity <<= 1;
+    }
+    return capacity;
+  }
+
+  static size_t window(const Table* t) {
+    return (t->mask < max_probe) ? t->mask+1 : max_probe;
+  }
+
+  // the probe position comes from the low bits of h, the tag from the high
+  static uint32_t tag_of(uint64_t h) {
+    return (uint32_t) (h >> 32) | 1;
+  }
+
+  // key is the caller's to keep, or nullptr to store a copy of u
+  int32_t insert(const Roaring& u, uint64_t h, uint32_t card, const ECKey* key) {
+    const uint32_t tag = tag_of(h);
+    Table* t = head_;
+    while (true) {
+      const size_t w = window(t);
+      for (size_t i = 0; i < w; i++) {
+        Slot& slot = t->slots[(h + i) & t->mask];
+        uint32_t st = slot.tag.load(std::memory_order_acquire);
+        if (st == 0) {
+          if (slot.tag.compare_exchange_strong(st, tag, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            slot.key.store((key != nullptr) ? key : new ECKey(u, h, card), std::memory_order_relaxed);
+            int32_t id = next_id_.fetch_add(1, std::memory_order_relaxed);
+            slot.id.store(id, std::memory_order_release);
+            return id;
+          }
+          // lost the race, st now holds the winner's tag
+        }
+        if (st == tag) {
+          int32_t id = wait_id(slot);
+          if (matches(slot, h, card, u)) {
+            return id;
+          }
+        }
+      }
+      Table* next = t->next.load(std::memory_order_acquire);
+      if (next == nullptr) {
+        Table* grown = new Table(2*(t->mask+1));
+        if (t->next.compare_exchange_strong(next, grown, std::memory_order_acq_rel, std::memory_order_acquire)) {
+          next = grown;
+        } else {
+          delete grown;
+        }
+      }
+      t = next;
+    }
+  }
+
+  // call after wait_id(), which makes the key visible
+  static bool matches(const Slot& slot, uint64_t h, uint32_t card, const Roaring& u) {
+    const ECKey* k = slot.key.load(std::memory_order_relaxed);
+    return k->fingerprint == h && k->card == card && k->ec == u;
+  }
+
+  static int32_t wait_id(const Slot& slot) {
+    int32_t id;
+    while ((id = slot.id.load(std::memory_order_acquire)) < 0) {
+      std::this_thread::yield();
+    }
+    return id;
+  }
+
+  Table* const head_;
+  std::atomic<int32_t> next_id_;
+  int32_t n_adopted_; // ids below this belong to adopted keys
+};
+
+#endif // KALLISTO_CONCURRENT_ECMAP_HPP
@@ -7,10 +7,16 @@
 #include "weights.h"
 
 #include <algorithm>
+#include <cmath>
 #include <numeric>
 #include <iostream>
 #include <limits>
 #include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
 
 // smallest weight we expect is ~10^-4
 // on most machines, TOLERANCE should be 2.22045e-15
@@ -18,6 +24,13 @@
 //const double TOLERANCE = 1e-100;
 const double TOLERANCE = std::numeric_limits<double>::denorm_min();
 
+// The EM stops once no alpha above ALPHA_CHANGE_LIMIT changes by more than
+// ALPHA_CHANGE (relative) between rounds; alphas below ALPHA_LIMIT/10 are then
+// set to zero
+const double ALPHA_LIMIT = 1e-7;
+const double ALPHA_CHANGE_LIMIT = 1e-2;
+const double ALPHA_CHANGE = 1e-2;
+
 struct EMAlgorithm {
   // ecmap is the ecmap from KmerIndex
   // counts is vector from collector, with indices corresponding to ec ids
@@ -39,6 +52,7 @@ struct EMAlgorithm {
     rho_(num_trans_, 0.0),
     rho_set_(false),
     all_fl_means(all_means),
+    num_threads_(std::max(opt.threads, 1)),
     opt(opt)
   {
     assert(all_fl_means.size() == index_.target_lens_.size());  
@@ -67,127 +81,458 @@ struct EMAlgorithm {
    else {
      eff_lens_ = calc_eff_lens(index_.target_lens_, all_fl_means);
    }
-    weight_map_ = calc_weights(tc_.counts, ecmapinv_, eff_lens_);
+    ecs_ = std::make_shared<const ECArena>(ecmapinv_);
+    weights_ = std::make_shared<const std::vector<double>>(calc_weights(tc_.counts, *ecs_, eff_lens_));
     assert(target_names_.size() == eff_lens_.size());
   }
 
-  ~EMAlgorithm() {}
+  // EM on resampled counts (a bootstrap) of what em_main ran on. The
+  // targets, effective lengths and weights are those of em_main; the EC
+  // arena and weights are shared rather than rebuilt. Like em_main it starts
+  // from a uniform alpha.
+  EMAlgorithm(const std::vector<uint32_t>& counts, const EMAlgorithm& em_main) :
+    num_trans_(em_main.num_trans_),
+    index_(em_main.index_),
+    tc_(em_main.tc_),
+    ecmapinv_(em_main.ecmapinv_),
+    counts_(counts),
+    target_names_(em_main.target_names_),
+    all_fl_means(em_main.all_fl_means),
+    eff_lens_(em_main.eff_lens_),
+    post_bias_(em_main.post_bias_),
+    ecs_(em_main.ecs_),
+    weights_(em_main.weights_),
+    alpha_(num_trans_, 1.0/num_trans_),
+    rho_(num_trans_, 0.0),
+    rho_set_(false),
+    num_threads_(em_main.num_threads_),
+    opt(em_main.opt)
+  {
+  }
 
-  void run(size_t n_iter = 10000, size_t min_rounds=50, bool verbose = true, bool recomputeEffLen = true) {
-    std::vector<double> next_alpha(alpha_.size(), 0.0);
+  ~EMAlgorithm() {}
 
-    assert(weight_map_.size() <= counts_.size());
+  // A set of transcripts together with the ECs (with non-zero counts and more
+  // than one target) that connect them. Components share no transcripts, so
+  // each one can be run to convergence on its own.
+  struct Component {
+    std::vector<uint32_t> ecs;
+    std::vector<uint32_t> trs;
+    double multi_counts = 0.0; // total count over ecs
+  };
+
+  // Where a component's EM currently stands
+  struct EMState {
+    size_t round = 0;
+    bool final_round = false;
+    bool done = false;
+    double step_max = 1.0; // SQUAREM step length bound
+  };
+
+  // Scratch vectors for EM rounds, indexed by transcript. Components only
+  // touch their own entries, so one set is shared by all of them.
+  struct EMBuffers {
+    std::vector<double> next_alpha, theta1, theta2, theta_x;
+  };
 
-    double denom;
-    const double alpha_limit = 1e-7;
-    const double alpha_change_limit = 1e-2;
-    const double alpha_change = 1e-2;
-    bool finalRound = false;
+  void run(size_t n_iter = 10000, size_t min_rounds=50, bool verbose = true, bool recomputeEffLen = true) {
+    assert(ecs_->size() <= counts_.size());
 
     if (verbose) {
       std::cerr << "[   em] quantifying the abundances ..."; std::cerr.flush();
     }
 
-    int i;
-    for (i = 0; i < n_iter; ++i) {
-      if (recomputeEffLen && (i == min_rounds || i == min_rounds + 500) && !opt.long_read) {
-        eff_lens_ = update_eff_lens(all_fl_means, tc_, index_, alpha_, eff_lens_, post_bias_, opt);
-        weight_map_ = calc_weights (tc_.counts, index_.ecmapinv, eff_lens_);
+    EMBuffers buf;
+    buf.next_alpha.assign(alpha_.size(), 0.0);
+    if (opt.squarem) {
+      buf.theta1.assign(alpha_.size(), 0.0);
+      buf.theta2.assign(alpha_.size(), 0.0);
+      buf.theta_x.assign(alpha_.size(), 0.0);
+    }
+    alpha_before_zeroes_.assign(alpha_.size(), 0.0);
+
+    auto recompute_round = [&](size_t j) {
+      if (!recomputeEffLen) {
+        return false;
       }
-      
-      if (recomputeEffLen && (i == min_rounds || i % min_rounds == 0) && opt.long_read) {
-        weight_map_ = calc_weights (tc_.counts, index_.ecmapinv, eff_lens_);
+      if (opt.long_read) {
+        return j == min_rounds || j % min_rounds == 0;
       }
+      return j == min_rounds || j == min_rounds + 500;
+    };
+
+    // The effective lengths (and so the weights) change at fixed rounds for
+    // every transcript at once; rounds in between form phases that are
+    // iterated without synchronizing.
+    std::vector<size_t> phase_ends;
+    for (size_t j = 1; j < n_iter; ++j) {
+      if (recompute_round(j)) {
+        phase_ends.push_back(j);
+      }
+    }
+    phase_ends.push_back(n_iter);
+
+    std::vector<Component> comps;
+    std::vector<EMState> states;
+    if (opt.em_components) {
+      comps = components();
+      states.resize(comps.size());
+      // transcripts outside every component get no mass from the EM
+      std::vector<bool> in_comp(num_trans_, false);
+      for (const auto& c : comps) {
+        for (auto tr : c.trs) {
+          in_comp[tr] = true;
+        }
+      }
+      for (int tr = 0; tr < num_trans_; tr++) {
+        if (!in_comp[tr]) {
+          alpha_[tr] = 0.0;
+        }
+      }
+    } else {
+      // a single component holding everything
+      comps.resize(1);
+      comps[0].trs.resize(num_trans_);
+      std::iota(comps[0].trs.begin(), comps[0].trs.end(), 0);
+      comps[0].ecs.resize(ecs_->size());
+      std::iota(comps[0].ecs.begin(), comps[0].ecs.end(), 0);
+      for (size_t ec = 0; ec < ecs_->size(); ++ec) {
+        if (ecs_->cardinality(ec) > 1) {
+          comps[0].multi_counts += counts_[ec];
+        }
+      }
+      states.resize(1);
+    }
 
+    // A component with more than its share of the (EC, target) entries
+    // would take longer on one thread than all the others together, so its
+    // EC passes are split across threads instead. The remaining components
+    // are handed out whole, one per thread.
+    size_t n_workers = std::max<size_t>(1, std::min<size_t>(num_threads_, ecs_->size()));
+    std::vector<size_t> entries(comps.size(), 0);
+    size_t total_entries = 0;
+    for (size_t k = 0; k < comps.size(); ++k) {
+      for (auto ec : comps[k].ecs) {
+        entries[k] += ecs_->cardinality(ec);
+      }
+      total_entries += entries[k];
+    }
+    std::vector<size_t> order(comps.size()); // components, largest first
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return entries[a] > entries[b];
+    });
+    size_t n_split = 0; // the first n_split components in order
+    while (n_split < order.size() && n_workers > 1 &&
+           (!opt.em_components || entries[order[n_split]] * n_workers > total_entries)) {
+      ++n_split;
+    }
+    if (n_split == 0) {
+      n_workers = 1;
+    }
 
-      /*** should this go after main loop? 
-      for (const auto& it : ecmapinv_) {
-        if (it.first.cardinality() == 1) {
-          next_alpha[it.first.maximum()] = counts_[it.second];
-          //std::cerr << "cardinality 1 : " << it.first.maximum() << " it.second: " << it.second << " counts_[it.second]: " << counts_[it.second] << std::endl; std::cerr.flush(); 
+    // Split the ECs of each of those into contiguous chunks holding roughly
+    // the same number of entries. Worker t accumulates its chunk into its
+    // own partial alpha vector, the calling thread handles chunk 0 directly
+    // into the output and then reduces the partial vectors each round.
+    std::vector<std::vector<size_t>> bounds(n_split);
+    for (size_t k = 0; k < n_split; ++k) {
+      const auto& ecs = comps[order[k]].ecs;
+      auto& b = bounds[k];
+      b.assign(n_workers+1, ecs.size());
+      b[0] = 0;
+      size_t i = 0, acc = 0;
+      for (size_t t = 1; t < n_workers; ++t) {
+        size_t target = (entries[order[k]] * t) / n_workers;
+        while (i < ecs.size() && acc < target) {
+          acc += ecs_->cardinality(ecs[i]);
+          ++i;
         }
+        b[t] = i;
       }
-      ***/
+    }
 
-      for (const auto& it : ecmapinv_) {
-        if (it.first.cardinality() == 1) { // Individual transcript
-          //std::cerr << "Should always enter here with toy error free simulation" << std::endl; std::cerr.flush(); 
-          continue;
+    std::vector<std::vector<double>> partial_alpha(n_workers-1, std::vector<double>(alpha_.size(), 0.0));
+    std::vector<double> partial_loglik(n_workers, 0.0);
+    const std::vector<double>* round_in = nullptr;
+    const Component* round_comp = nullptr;
+    const std::vector<size_t>* round_bounds = nullptr;
+    bool round_loglik = false;
+    std::vector<std::thread> workers;
+    std::mutex round_mutex;
+    std::condition_variable round_cv, done_cv;
+    size_t round = 0, n_done = 0;
+    bool quit = false;
+    auto em_chunk = [&](size_t t, const std::vector<double>& in, std::vector<double>& out, bool loglik) {
+      double ll = 0.0;
+      for (size_t i = (*round_bounds)[t]; i < (*round_bounds)[t+1]; ++i) {
+        ll += em_ec(round_comp->ecs[i], in, out, loglik);
+      }
+      return ll;
+    };
+    for (size_t t = 1; t < n_workers; ++t) {
+      workers.emplace_back([&, t]() {
+        size_t seen = 0;
+        while (true) {
+          {
+            std::unique_lock<std::mutex> lock(round_mutex);
+            round_cv.wait(lock, [&]{ return quit || round != seen; });
+            if (quit) {
+              return;
+            }
+            seen = round;
+          }
+          partial_loglik[t] = em_chunk(t, *round_in, partial_alpha[t-1], round_loglik);
+          {
+            std::lock_guard<std::mutex> lock(round_mutex);
+            ++n_done;
+          }
+          done_cv.notify_one();
         }
+      });
+    }
 
-        denom = 0.0;
+    // One EM pass over the ECs of c, out = F(in), using every worker
+    auto em_round_split = [&](const Component& c, const std::vector<size_t>& b,
+                              const std::vector<double>& in, std::vector<double>& out, bool loglik) {
+      {
+        std::lock_guard<std::mutex> lock(round_mutex);
+        round_in = &in;
+        round_comp = &c;
+        round_bounds = &b;
+        round_loglik = loglik;
+        ++round;
+        n_done = 0;
+      }
+      round_cv.notify_all();
+      partial_loglik[0] = em_chunk(0, in, out, loglik);
+      {
+        std::unique_lock<std::mutex> lock(round_mutex);
+        done_cv.wait(lock, [&]{ return n_done == n_workers - 1; });
+      }
+      // reduce in a fixed order so the result only depends on the number
+      // of threads, not on their scheduling
+      double ll = partial_loglik[0];
+      for (size_t t = 1; t < n_workers; ++t) {
+        auto& pa = partial_alpha[t-1];
+        for (auto tr : c.trs) {
+          out[tr] += pa[tr];
+          pa[tr] = 0.0;
+        }
+        ll += partial_loglik[t];
+      }
+      return ll;
+    };
 
-        if (counts_[it.second] == 0) {
-          continue;
+    size_t phase_begin = 0;
+    for (size_t phase_end : phase_ends) {
+      if (std::all_of(states.begin(), states.end(), [](const EMState& st) { return st.done; })) {
+        break;
+      }
+      if (recompute_round(phase_begin)) {
+        if (!opt.long_read) {
+          eff_lens_ = update_eff_lens(all_fl_means, tc_, index_, alpha_, eff_lens_, post_bias_, opt);
+        }
+        weights_ = std::make_shared<const std::vector<double>>(calc_weights(tc_.counts, *ecs_, eff_lens_));
+        for (auto& st : states) {
+          st.step_max = 1.0;
+        }
+      }
+
+      for (size_t k = 0; k < n_split; ++k) {
+        const auto& c = comps[order[k]];
+        const auto& b = bounds[k];
+        auto em_round = [&](const std::vector<double>& in, std::vector<double>& out, bool loglik) {
+          return em_round_split(c, b, in, out, loglik);
+        };
+        iterate(c, states[order[k]], buf, em_round, phase_end, min_rounds);
+      }
+      // the other components are independent, so the result does not
+      // depend on which thread picks up which one
+      std::atomic<size_t> next(n_split);
+      auto solve = [&]() {
+        for (size_t k = next++; k < order.size(); k = next++) {
+          const auto& c = comps[order[k]];
+          auto em_round = [&](const std::vector<double>& in, std::vector<double>& out, bool loglik) {
+            double ll = 0.0;
+            for (auto ec : c.ecs) {
+              ll += em_ec(ec, in, out, loglik);
+            }
+            return ll;
+          };
+          iterate(c, states[order[k]], buf, em_round, phase_end, min_rounds);
         }
+      };
+      std::vector<std::thread> solvers;
+      for (int t = 1; t < std::min<int>(num_threads_, order.size() - n_split); ++t) {
+        solvers.emplace_back(solve);
+      }
+      solve();
+      for (auto& s : solvers) {
+        s.join();
+      }
+      phase_begin = phase_end;
+    }
 
-        // first, compute the denominator: a normalizer
-        // iterate over targets in EC map
-        auto& wv = weight_map_[it.second];
+    {
+      std::lock_guard<std::mutex> lock(round_mutex);
+      quit = true;
+    }
+    round_cv.notify_all();
+    for (auto& w : workers) {
+      w.join();
+    }
+
+    //TRYING PLACING HERE INSTEAD 
+    for (size_t ec = 0; ec < ecs_->size(); ++ec) {
+      if (ecs_->cardinality(ec) == 1) {
+        alpha_[ecs_->trs[ecs_->offsets[ec]]] += counts_[ec];
+      }
+    }
 
-        // everything in ecmap should be in weight_map
-        //assert( w_search != weight_map_.end() );
-        //assert( w_search->second.size() == ec_kv.second.size() );
+    // ran for the maximum number of iterations
+    num_rounds_ = 0;
+    for (size_t k = 0; k < comps.size(); ++k) {
+      if (!states[k].done) {
+        for (auto tr : comps[k].trs) {
+          alpha_before_zeroes_[tr] = alpha_[tr];
+        }
+      }
+      num_rounds_ = std::max(num_rounds_, states[k].round);
+    }
 
-        // wv is weights vector
-        // trs is a vector of transcript ids
+    if (verbose) {
+      std::cerr << " done" << std::endl;
+      std::cerr << "[   em] the Expectation-Maximization algorithm ran for "
+        << pretty_num(num_rounds_) << " rounds";
+      if (opt.em_components) {
+        std::cerr << " over " << pretty_num(comps.size()) << " components";
+      }
+      std::cerr << std::endl;
+      std::cerr.flush();
+    }
 
-        auto& r = it.first; //ecmap_.find(ec)->second;
-        auto numEC = r.cardinality();
-        uint32_t* trs = new uint32_t[numEC];
-        r.toUint32Array(trs);
+  }
 
-        for (auto t_it = 0; t_it < numEC; ++t_it) {
-          denom += alpha_[trs[t_it]] * wv[t_it];
+  // Runs EM rounds on one component until it has converged or reached
+  // round_end. em_round(in, out, loglik) performs one pass over the
+  // component's ECs, out = F(in), returning the log-likelihood of in when
+  // asked to.
+  template <typename Round>
+  void iterate(const Component& c, EMState& st, EMBuffers& buf, Round em_round, size_t round_end, size_t min_rounds) {
+    auto& next_alpha = buf.next_alpha;
+    auto& theta1 = buf.theta1;
+    auto& theta2 = buf.theta2;
+    auto& theta_x = buf.theta_x;
+
+    // number of alphas that changed by more than ALPHA_CHANGE between rounds
+    auto count_changes = [&](const std::vector<double>& prev, const std::vector<double>& next) {
+      int chcount = 0;
+      for (auto tr : c.trs) {
+        if (next[tr] > ALPHA_CHANGE_LIMIT && (std::fabs(next[tr] - prev[tr]) / next[tr]) > ALPHA_CHANGE) {
+          chcount++;
         }
+      }
+      return chcount;
+    };
+
+    // alpha itself is not normalized, so neither is the likelihood
+    auto loglik = [&](const std::vector<double>& in, std::vector<double>& out) {
+      double ll = em_round(in, out, true);
+      double total = 0.0;
+      for (auto tr : c.trs) {
+        total += in[tr];
+      }
+      if (total <= 0.0) {
+        return -std::numeric_limits<double>::infinity();
+      }
+      return ll - c.multi_counts * std::log(total);
+    };
+
+    while (!st.done && st.round < round_end) {
+      size_t i = st.round;
+
+      // A SQUAREM cycle costs three EM passes; only take it when the weights
+      // stay fixed across those passes, otherwise fall back to a plain round
+      if (opt.squarem && !st.final_round && i + 2 < round_end) {
+        double ll0 = loglik(alpha_, theta1);
+
+        // same stopping criterion as the plain EM at alpha_
+        if (count_changes(alpha_, theta1) > 0 || i <= min_rounds) {
+          em_round(theta1, theta2, false);
+
+          // r = theta1 - alpha, v = theta2 - 2 theta1 + alpha
+          double rr = 0.0, vv = 0.0;
+          for (auto tr : c.trs) {
+            double r = theta1[tr] - alpha_[tr];
+            double v = theta2[tr] - 2*theta1[tr] + alpha_[tr];
+            rr += r*r;
+            vv += v*v;
+          }
+          double step = (vv > 0.0) ? -std::sqrt(rr/vv) : -1.0;
+          step = std::max(std::min(step, -1.0), -st.step_max);
+
+          // step lengths that push an abundance negative are pulled back
+          // towards -1, which is exactly theta2
+          bool valid = false;
+          while (!valid) {
+            valid = true;
+            for (auto tr : c.trs) {
+              double r = theta1[tr] - alpha_[tr];
+              double v = theta2[tr] - 2*theta1[tr] + alpha_[tr];
+              theta_x[tr] = alpha_[tr] - 2*step*r + step*step*v;
+              if (theta_x[tr] < 0.0) {
+                if (step > -1.0 - 1e-3) {
+                  theta_x[tr] = 0.0; // rounding error only
+                } else {
+                  valid = false;
+                  break;
+                }
+              }
+            }
+            if (!valid) {
+              step = (step - 1.0) / 2.0;
+            }
+          }
 
-        if (denom < TOLERANCE) {
+          // stabilizing EM pass from the extrapolated point; reject it if it
+          // lowered the likelihood, in which case theta2 is a safe EM iterate
+          double llx = loglik(theta_x, next_alpha);
+          bool accept = std::isfinite(llx) && llx >= ll0;
+          for (auto tr : c.trs) {
+            alpha_[tr] = accept ? next_alpha[tr] : theta2[tr];
+            next_alpha[tr] = 0.0;
+            theta1[tr] = 0.0;
+            theta2[tr] = 0.0;
+          }
+          if (!accept) {
+            st.step_max = std::max(1.0, st.step_max / 4.0);
+          } else if (step == -st.step_max) {
+            st.step_max *= 4.0;
+          }
+          st.round += 3;
           continue;
         }
 
-        // compute the update step
-        auto countNorm = counts_[it.second] / denom;
-        
-        //std::cerr << "countNorm: " << countNorm << std::endl; std::cerr.flush();
-        //std::cerr <<"numEC is " << numEC << std::endl; std::cerr.flush(); 
-        for (auto t_it = 0; t_it < numEC; ++t_it) {
-          //std::cerr <<"t_it is: " << t_it << ", alpha is: " << alpha_[trs[t_it]] << " wv[t_it] is: " << wv[t_it] << " trs[t_it] is:" << trs[t_it] << std::endl; std::cerr.flush(); 
-          next_alpha[trs[t_it]] += (wv[t_it] * alpha_[trs[t_it]]) * countNorm;
+        // converged at alpha_, theta1 is the plain EM update
+        for (auto tr : c.trs) {
+          next_alpha[tr] = theta1[tr];
+          theta1[tr] = 0.0;
         }
-
-        delete[] trs;
-        trs = nullptr;
-
+      } else {
+        em_round(alpha_, next_alpha, false);
       }
 
       // TODO: check for relative difference for convergence in EM
 
       bool stopEM = false; //!finalRound && (i >= min_rounds); // false initially
-      //double maxChange = 0.0;
-      int chcount = 0;
-      for (int ec = 0; ec < num_trans_; ec++) {
-        if (next_alpha[ec] > alpha_change_limit && (std::fabs(next_alpha[ec] - alpha_[ec]) / next_alpha[ec]) > alpha_change) {
-          chcount++;
-        }
-
-        //if (stopEM && next_alpha[ec] >= alpha_limit) {
-
-          /* double reldiff = abs(next_alpha[ec]-alpha_[ec]) / next_alpha[ec];
-          if (reldiff >= alpha_change) {
-            stopEM = false;
-            }*/
-        //}
-
-        /*
-        if (next_alpha[ec] > alpha_limit) {
-          maxChange = std::max(maxChange,std::fabs(next_alpha[ec]-alpha_[ec]) / next_alpha[ec]);
-        }
-        */
+      int chcount = count_changes(alpha_, next_alpha);
+      for (auto tr : c.trs) {
         // reassign alpha_ to next_alpha
-        alpha_[ec] = next_alpha[ec];
+        alpha_[tr] = next_alpha[tr];
 
         // clear all next_alpha values 0 for next iteration
-        next_alpha[ec] = 0.0;
+        next_alpha[tr] = 0.0;
       }
 
       //std::cout << chcount << std::endl;
@@ -196,48 +541,121 @@ struct EMAlgorithm {
         stopEM=true;
       }
 
-      if (finalRound) {
+      if (st.final_round) {
+        st.done = true;
         break;
       }
+      st.round = i + 1;
 
       // std::cout << maxChange << std::endl;
       if (stopEM) {
-        finalRound = true;
-        alpha_before_zeroes_.resize( alpha_.size() );
-        for (int ec = 0; ec < num_trans_; ec++) {
-          alpha_before_zeroes_[ec] = alpha_[ec];
-          if (alpha_[ec] < alpha_limit/10.0) {
-            alpha_[ec] = 0.0;
+        st.final_round = true;
+        for (auto tr : c.trs) {
+          alpha_before_zeroes_[tr] = alpha_[tr];
+          if (alpha_[tr] < ALPHA_LIMIT/10.0) {
+            alpha_[tr] = 0.0;
           }
         }
       }
-
     }
+  }
 
-    //TRYING PLACING HERE INSTEAD 
-    for (const auto& it : ecmapinv_) {
-      if (it.first.cardinality() == 1) {
-        alpha_[it.first.maximum()] += counts_[it.second];
-        //std::cerr << "cardinality 1 : " << it.first.maximum() << " it.second: " << it.second << " counts_[it.second]: " << counts_[it.second] << std::endl; std::cerr.flush(); 
+  // Splits the graph of transcripts linked by (multi-target, observed) ECs
+  // into connected components
+  std::vector<Component> components() const {
+    std::vector<uint32_t> parent(num_trans_);
+    std::iota(parent.begin(), parent.end(), 0);
+    auto find = [&](uint32_t x) {
+      while (parent[x] != x) {
+        parent[x] = parent[parent[x]];
+        x = parent[x];
+      }
+      return x;
+    };
+
+    for (size_t ec = 0; ec < ecs_->size(); ++ec) {
+      if (ecs_->cardinality(ec) < 2 || counts_[ec] == 0) {
+        continue;
+      }
+      uint32_t root = find(ecs_->trs[ecs_->offsets[ec]]);
+      for (auto j = ecs_->offsets[ec] + 1; j < ecs_->offsets[ec+1]; ++j) {
+        uint32_t r = find(ecs_->trs[j]);
+        if (r != root) {
+          // keep the smallest transcript id as the root
+          if (r < root) {
+            std::swap(r, root);
+          }
+          parent[r] = root;
+        }
       }
     }
 
-    // ran for the maximum number of iterations
-    if (n_iter == i) {
-      alpha_before_zeroes_.resize( alpha_.size() );
-      for (int ec = 0; ec < num_trans_; ec++) {
-        alpha_before_zeroes_[ec] = alpha_[ec];
+    // number the components in order of their first EC
+    std::vector<Component> comps;
+    std::vector<int> comp_id(num_trans_, -1);
+    for (size_t ec = 0; ec < ecs_->size(); ++ec) {
+      if (ecs_->cardinality(ec) < 2 || counts_[ec] == 0) {
+        continue;
+      }
+      uint32_t root = find(ecs_->trs[ecs_->offsets[ec]]);
+      if (comp_id[root] == -1) {
+        comp_id[root] = comps.size();
+        comps.emplace_back();
+      }
+      auto& c = comps[comp_id[root]];
+      c.ecs.push_back(ec);
+      c.multi_counts += counts_[ec];
+    }
+    for (int tr = 0; tr < num_trans_; tr++) {
+      int id = comp_id[find(tr)];
+      if (id != -1) {
+        comps[id].trs.push_back(tr);
       }
     }
+    return comps;
+  }
 
-    if (verbose) {
-      std::cerr << " done" << std::endl;
-      std::cerr << "[   em] the Expectation-Maximization algorithm ran for "
-        << pretty_num(i) << " rounds";
-      std::cerr << std::endl;
-      std::cerr.flush();
+  // The EM update for a single EC
+  inline double em_ec(size_t ec, const std::vector<double>& alpha, std::vector<double>& next_alpha, bool loglik) const {
+    auto beg = ecs_->offsets[ec];
+    auto end = ecs_->offsets[ec+1];
+    if (end - beg == 1) { // Individual transcript
+      return 0.0;
+    }
+
+    if (counts_[ec] == 0) {
+      return 0.0;
+    }
+
+    // wv is the weights vector and trs the transcript ids, both laid out
+    // contiguously in the EC arena
+    const uint32_t* trs = ecs_->trs.data();
+    const double* wv = weights_->data();
+
+    // first, compute the denominator: a normalizer
+    double denom = 0.0;
+    for (auto t_it = beg; t_it < end; ++t_it) {
+      denom += alpha[trs[t_it]] * wv[t_it];
+    }
+
+    double ll = loglik ? counts_[ec] * std::log(std::max(denom, TOLERANCE)) : 0.0;
+
+    if (denom < TOLERANCE) {
+      return ll;
     }
 
+    // compute the update step
+    auto countNorm = counts_[ec] / denom;
+    for (auto t_it = beg; t_it < end; ++t_it) {
+      next_alpha[trs[t_it]] += (wv[t_it] * alpha[trs[t_it]]) * countNorm;
+    }
+    return ll;
+  }
+
+  // Number of threads used by run(); bootstraps that already run in parallel
+  // should set this to 1
+  void set_num_threads(int n) {
+    num_threads_ = std::max(n, 1);
   }
 
   void compute_rho() {
@@ -339,11 +757,15 @@ struct EMAlgorithm {
   const std::vector<double>& all_fl_means;
   std::vector<double> eff_lens_;
   std::vector<double> post_bias_;
-  WeightMap weight_map_;
+  // shared with the bootstrap EMs started from this one
+  std::shared_ptr<const ECArena> ecs_;
+  std::shared_ptr<const std::vector<double>> weights_; // laid out like ecs_->trs
   std::vector<double> alpha_;
   std::vector<double> alpha_before_zeroes_;
   std::vector<double> rho_;
   bool rho_set_;
+  int num_threads_;
+  size_t num_rounds_ = 0; // EM passes over the ECs in the last run()
   const ProgramOptions& opt;
 };
 
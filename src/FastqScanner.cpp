@@ -0,0 +1,153 @@
+#include "FastqScanner.h"
+
+#include <cstring>
+#include <cctype>
+
+#ifdef KALLISTO_FASTQ_SCANNER_X86
+#include <immintrin.h>
+#endif
+
+FastqScanner::FastqScanner(gzFile f, size_t block) :
+  f(f), buf(block), len(0), cur(0), lines(block), nlines(0), next_line(0),
+  base(0), pending(0), eof(false) {}
+
+int FastqScanner::read(FastqRecord& r) {
+  while (true) {
+    pending = base + cur;
+    if (next_line + 4 <= nlines) {
+      const char* nl[4];
+      for (int j = 0; j < 4; j++) {
+        nl[j] = buf.data() + lines[next_line + j];
+      }
+      int l = parse(buf.data() + cur, nl, r);
+      if (l >= 0) {
+        next_line += 4;
+        cur = lines[next_line - 1] + 1;
+      }
+      return l;
+    }
+    if (eof) {
+      return (cur == len) ? -1 : -2; // anything left is not a whole record
+    }
+    fill();
+  }
+}
+
+bool FastqScanner::fill() {
+  size_t left = len - cur;
+  memmove(buf.data(), buf.data() + cur, left);
+  base += cur;
+  cur = 0;
+  len = left;
+  if (len == buf.size()) { // a record longer than a block
+    buf.resize(2 * buf.size());
+    lines.resize(buf.size());
+  }
+  int n = gzread(f, buf.data() + len, buf.size() - len);
+  if (n <= 0) {
+    eof = true;
+  } else {
+    len += n;
+  }
+  nlines = newlinesKernel()(buf.data(), len, lines.data());
+  next_line = 0;
+  return !eof;
+}
+
+int FastqScanner::parse(const char* p, const char* const nl[4], FastqRecord& r) {
+  if (*p != '@') {
+    return -2;
+  }
+  const char* h = p + 1;
+  const char* h_end = nl[0];
+  const char* s = h_end + 1;
+  const char* s_end = nl[1];
+  if (s_end[1] != '+') {
+    return -2;
+  }
+  const char* q = nl[2] + 1;
+  int l = s_end - s;
+  if (nl[3] - q != l) {
+    return -2; // quality on several lines, or of another length
+  }
+  if (h_end[-1] == '\r' || (l > 0 && s_end[-1] == '\r')) {
+    return -2; // kseq strips the \r
+  }
+
+  const char* sep = h;
+  while (sep < h_end && !isspace((unsigned char) *sep)) {
+    sep++;
+  }
+  r.name = h;
+  r.name_len = sep - h;
+  if (sep < h_end) {
+    r.comment = sep + 1;
+    r.comment_len = h_end - sep - 1;
+  } else {
+    r.comment = h_end;
+    r.comment_len = 0;
+  }
+  r.seq = s;
+  r.qual = q;
+  return l;
+}
+
+size_t FastqScanner::newlinesScalar(const char* p, size_t n, uint32_t* out) {
+  size_t k = 0;
+  for (size_t i = 0; i < n; i++) {
+    out[k] = i;
+    k += (p[i] == '\n') ? 1 : 0;
+  }
+  return k;
+}
+
+#ifdef KALLISTO_FASTQ_SCANNER_X86
+// The newlines of each 16 or 32 bytes come out as the set bits of a mask,
+// about one per 60 bytes in FASTQ. SSE2 is part of x86-64, AVX2 is picked
+// at run time.
+size_t FastqScanner::newlinesSSE2(const char* p, size_t n, uint32_t* out) {
+  const __m128i nl = _mm_set1_epi8('\n');
+  size_t k = 0, i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (p + i));
+    uint32_t m = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+    while (m != 0) {
+      out[k++] = i + __builtin_ctz(m);
+      m &= m - 1;
+    }
+  }
+  for (; i < n; i++) {
+    out[k] = i;
+    k += (p[i] == '\n') ? 1 : 0;
+  }
+  return k;
+}
+
+__attribute__((target("avx2")))
+size_t FastqScanner::newlinesAVX2(const char* p, size_t n, uint32_t* out) {
+  const __m256i nl = _mm256_set1_epi8('\n');
+  size_t k = 0, i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) (p + i));
+    uint32_t m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+    while (m != 0) {
+      out[k++] = i + __builtin_ctz(m);
+      m &= m - 1;
+    }
+  }
+  for (; i < n; i++) {
+    out[k] = i;
+    k += (p[i] == '\n') ? 1 : 0;
+  }
+  return k;
+}
+#endif
+
+FastqScanner::Kernel FastqScanner::newlinesKernel() {
+#ifdef KALLISTO_FASTQ_SCANNER_X86
+  static const Kernel kernel = __builtin_cpu_supports("avx2") ? newlinesAVX2 : newlinesSSE2;
+  return kernel;
+#else
+  return newlinesScalar;
+#endif
+}
@@ -0,0 +1,93 @@
+#ifndef KALLISTO_FASTQ_SCANNER_H
+#define KALLISTO_FASTQ_SCANNER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <zlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KALLISTO_FASTQ_SCANNER_X86
+#endif
+
+// A FASTQ record pointing into the text it was parsed from, which is not
+// '\0' terminated.
+struct FastqRecord {
+  const char* name;
+  int name_len;
+  const char* comment; // the rest of the header line, after the space
+  int comment_len;
+  const char* seq;
+  const char* qual;
+};
+
+// Reads FASTQ records from a gzFile a block at a time. All the newlines of
+// a block are found in one vectorized pass, after which a record is four
+// consecutive lines and parsing it is a few checks.
+//
+// Only plain four-line records are read. A record wrapped over several
+// lines, with \r\n line ends, or with anything else kseq would have to
+// make sense of ends the scan, and the caller reads on with kseq from
+// begin(): first the bytes the scanner has already read, rest(), then the
+// gzFile itself.
+class FastqScanner {
+public:
+  explicit FastqScanner(gzFile f, size_t block = default_block);
+
+  // As kseq_read: the length of the sequence of the next record, or -1 at
+  // the end of the file. -2 if the record is not four plain lines. r
+  // points into the scanner, and is good until the next call.
+  int read(FastqRecord& r);
+
+  // the uncompressed offset of the record last read
+  uint64_t begin() const {
+    return pending;
+  }
+
+  // The bytes from begin() on that have been read from the gzFile, which
+  // goes on right after them. Only meaningful once read() returned -2.
+  const char* rest() const {
+    return buf.data() + cur;
+  }
+  size_t restSize() const {
+    return len - cur;
+  }
+
+  // Makes r the record at p, which is '@' if it is one, whose lines end at
+  // the newlines nl[0..4); returns the length of the sequence, or -2.
+  static int parse(const char* p, const char* const nl[4], FastqRecord& r);
+
+  // Writes the offsets of the '\n' in p[0..n) to out, which has room for n,
+  // and returns how many there are.
+  typedef size_t (*Kernel)(const char* p, size_t n, uint32_t* out);
+
+  static size_t newlinesScalar(const char* p, size_t n, uint32_t* out);
+#ifdef KALLISTO_FASTQ_SCANNER_X86
+  static size_t newlinesSSE2(const char* p, size_t n, uint32_t* out);
+  static size_t newlinesAVX2(const char* p, size_t n, uint32_t* out);
+#endif
+
+  // the fastest kernel this CPU supports
+  static Kernel newlinesKernel();
+
+  static const size_t default_block = 1ULL<<20;
+
+private:
+  // keeps what is left of the block and reads another after it, false at
+  // the end of the file
+  bool fill();
+
+  gzFile f;
+  std::vector<char> buf;
+  size_t len; // bytes in buf
+  size_t cur; // where the next record starts in buf
+  std::vector<uint32_t> lines; // the newlines in buf
+  size_t nlines;
+  size_t next_line; // the first newline after cur
+  uint64_t base; // the uncompressed offset of buf
+  uint64_t pending;
+  bool eof;
+};
+
+#endif // KALLISTO_FASTQ_SCANNER_H
@@ -0,0 +1,78 @@
+#ifndef KALLISTO_KMER_BLOOM_FILTER_HPP
+#define KALLISTO_KMER_BLOOM_FILTER_HPP
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+
+#include "Kmer.hpp"
+
+// Bloom filter over canonical k-mers. All bits of a k-mer live in one
+// 512-bit block aligned to a cache line, so a query costs at most one
+// cache miss. The block is picked by one hash of the k-mer and the bits
+// within it by a second one. There are no false negatives.
+class KmerBloomFilter {
+public:
+  KmerBloomFilter() {}
+
+  // Sized for n k-mers at bits_per_kmer bits each.
+  explicit KmerBloomFilter(size_t n, size_t bits_per_kmer = 12) : blocks_((n * bits_per_kmer + 511) / 512 + 1) {}
+
+  bool empty() const {
+    return blocks_.empty();
+  }
+
+  size_t sizeInBytes() const {
+    return blocks_.size() * sizeof(Block);
+  }
+
+  void insert(const Kmer& km) {
+    const Kmer rep = km.rep();
+    Block& b = blocks_[block(rep)];
+    uint64_t h = rep.hash(1);
+    for (int i = 0; i < num_hashes; i++, h >>= 9) {
+      b.words[(h >> 6) & 7] |= 1ULL << (h & 63);
+    }
+  }
+
+  bool contains(const Kmer& km) const {
+    const Kmer rep = km.rep();
+    const Block& b = blocks_[block(rep)];
+    uint64_t h = rep.hash(1);
+    for (int i = 0; i < num_hashes; i++, h >>= 9) {
+      if ((b.words[(h >> 6) & 7] & (1ULL << (h & 63))) == 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void write(std::ostream& out) const {
+    size_t n = blocks_.size();
+    out.write((char *)&n, sizeof(n));
+    out.write((char *)blocks_.data(), sizeInBytes());
+  }
+
+  void read(std::istream& in) {
+    size_t n;
+    in.read((char *)&n, sizeof(n));
+    blocks_.resize(n);
+    in.read((char *)blocks_.data(), sizeInBytes());
+  }
+
+private:
+  struct alignas(64) Block {
+    uint64_t words[8] = {0};
+  };
+
+  // 7 bit positions are taken 9 bits at a time from the second hash
+  static const int num_hashes = 7;
+
+  size_t block(const Kmer& rep) const {
+    return (size_t) (((unsigned __int128) rep.hash() * blocks_.size()) >> 64);
+  }
+
+  std::vector<Block> blocks_;
+};
+
+#endif // KALLISTO_KMER_BLOOM_FILTER_HPP
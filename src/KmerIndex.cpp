@@ -494,6 +494,7 @@ void KmerIndex::BuildDeBruijnGraph(const ProgramOptions& opt, const std::string&
   onlist_sequences = Roaring();
   onlist_sequences.addRange(0, num_trans);
   DListFlankingKmers(opt, tmp_file);
+  setOnlistEnd();
 
   // 1. write version
   out.write((char *)&INDEX_VERSION, sizeof(INDEX_VERSION));
@@ -864,6 +865,24 @@ void KmerIndex::PopulateMosaicECs(std::vector<std::vector<TRInfo> >& trinfos) {
   }
 }
 
+void KmerIndex::internBlockECs() {
+  u_map_<ECKey, uint32_t, ECKeyHasher, ECKeyEqual> sets;
+  for (const auto& um : dbg) {
+    um.getData()->ec.for_each_val([&](SparseVector<uint32_t>& sv) {
+      auto it = sets.find(sv.getIndices());
+      if (it == sets.end()) {
+        it = sets.insert({ECKey(sv.getIndices()), (uint32_t) sets.size()}).first;
+      }
+      sv.setSetId(it->second);
+    });
+  }
+}
+
+void KmerIndex::setOnlistEnd() {
+  uint64_t n = onlist_sequences.cardinality();
+  onlist_end = (n > 0 && onlist_sequences.maximum() == n-1) ? n : 0;
+}
+
 void KmerIndex::write(std::ofstream& out, int threads) {
 
   size_t tmp_size;
@@ -918,6 +937,13 @@ void KmerIndex::write(std::ofstream& out, int threads) {
   delete[] buffer;
   buffer = nullptr;
 
+  // 8. Write k-mer Bloom filter, if any
+  tmp_size = kmer_filter.empty() ? 0 : 1;
+  out.write((char *)&tmp_size, sizeof(tmp_size));
+  if (!kmer_filter.empty()) {
+    kmer_filter.write(out);
+  }
+
 }
 
 void KmerIndex::write(const std::string& index_out, bool writeKmerTable, int threads) {
@@ -1009,6 +1035,13 @@ void KmerIndex::write(const std::string& index_out, bool writeKmerTable, int thr
   delete[] buffer;
   buffer = nullptr;
 
+  // 8. Write k-mer Bloom filter, if any
+  tmp_size = kmer_filter.empty() ? 0 : 1;
+  out.write((char *)&tmp_size, sizeof(tmp_size));
+  if (!kmer_filter.empty()) {
+    kmer_filter.write(out);
+  }
+
   out.flush();
   out.close();
 }
@@ -1132,6 +1165,7 @@ void KmerIndex::load(ProgramOptions& opt, bool loadKmerTable, bool loadDlist) {
   buffer = nullptr;
   std::vector<std::pair<char*, std::pair<Kmer, uint32_t> > >().swap(in_buf_v); // potentially free up memory
   std::vector<std::thread>().swap(workers);
+  internBlockECs();
 
   // 4. read number of targets
   in.read((char *)&num_trans, sizeof(num_trans));
@@ -1176,16 +1210,25 @@ void KmerIndex::load(ProgramOptions& opt, bool loadKmerTable, bool loadDlist) {
   buffer = new char[tmp_size];
   in.read(buffer, tmp_size);
   onlist_sequences = onlist_sequences.read(buffer);
+  setOnlistEnd();
 
   // delete the buffer
   delete[] buffer;
   buffer=nullptr;
 
+  // 8. Read k-mer Bloom filter, absent from indices built without one
+  if (in.read((char *)&tmp_size, sizeof(tmp_size)) && tmp_size != 0) {
+    kmer_filter.read(in);
+  }
+
   std::cerr << "[index] number of targets: " << pretty_num(static_cast<size_t>(onlist_sequences.cardinality())) << std::endl;
   std::cerr << "[index] number of k-mers: " << pretty_num(dbg.nbKmers()) << std::endl;
   if (num_trans-onlist_sequences.cardinality() > 0) {
     std::cerr << "[index] number of distinguishing flanking k-mers: " << pretty_num(static_cast<size_t>(num_trans-onlist_sequences.cardinality())) << std::endl;
   }
+  if (!kmer_filter.empty()) {
+    std::cerr << "[index] k-mer Bloom filter: " << pretty_num(kmer_filter.sizeInBytes()) << " bytes" << std::endl;
+  }
 
   in.close();
 
@@ -1233,7 +1276,7 @@ void KmerIndex::loadECsFromFile(const ProgramOptions& opt) {
         }
         r.add(tmp_ecval_num);
       }
-      ecmapinv.insert({std::move(r), i}); // move
+      ecmapinv.insert({ECKey(std::move(r)), i}); // move
       i++;
     }
   } else {
@@ -1264,14 +1307,169 @@ void KmerIndex::loadTranscriptsFromFile(const ProgramOptions& opt) {
             << pretty_num(num_trans) << std::endl;
 }
 
-int KmerIndex::mapPair(const char *s1, int l1, const char *s2, int l2) const {
-  bool d1 = true;
-  bool d2 = true;
-  int p1 = -1;
-  int p2 = -1;
-  int c1 = -1;
-  int c2 = -1;
+// The running intersection of the ECs of the hits match() has pushed, for
+// early_exit. Empty ECs are skipped, as in MinCollector::intersectECs. The
+// intersection only ever shrinks, so once it is empty the read maps to
+// nothing whatever the rest of it holds.
+class RunningEC {
+public:
+  // folds in the hits of v not seen yet; true if at most one target is left
+  bool settled(const std::vector<std::pair<const_UnitigMap<Node>, int>>& v) {
+    for (; seen < v.size() && (cur == nullptr || !cur->isEmpty()); seen++) {
+      const auto& ec = v[seen].first.getData()->ec[v[seen].first.dist];
+      if (ec.isEmpty() || (last != nullptr && ec == *last)) {
+        continue;
+      }
+      if (cur == nullptr) {
+        cur = &ec.getIndices();
+      } else {
+        if (cur != &r) {
+          r = *cur;
+          cur = &r;
+        }
+        SmallEC::mask(r, ec.getIndices());
+      }
+      last = &ec;
+    }
+    return cur != nullptr && cur->cardinality() <= 1;
+  }
+
+  bool empty() const {
+    return cur->isEmpty();
+  }
+
+  uint32_t target() const {
+    return cur->minimum();
+  }
+
+private:
+  size_t seen = 0;
+  const SparseVector<uint32_t>* last = nullptr;
+  const Roaring* cur = nullptr;
+  Roaring r;
+};
+
+// how many k-mers confirmTarget() looks at
+static const int early_exit_samples = 3;
+
+bool KmerIndex::confirmTarget(const char *s, int l, int from, uint32_t tr, std::vector<std::pair<const_UnitigMap<Node>, int>>& v) const {
+  const int last = l - k;
+  const size_t n = v.size();
+  int prev = from - 1;
+  for (int i = 1; i <= early_exit_samples; ++i) {
+    int p = from + (last - from) * i / early_exit_samples;
+    if (p <= prev || !std::all_of(s + p, s + p + k, isDNA)) {
+      continue;
+    }
+    prev = p;
+    const_UnitigMap<Node> um = dbg.find(Kmer(s + p));
+    if (um.isEmpty) {
+      continue;
+    }
+    const auto& ec = um.getData()->ec[um.dist];
+    if (!ec.isEmpty() && !ec.getIndices().contains(tr)) {
+      v.resize(n);
+      return false;
+    }
+    v.push_back({um, p});
+  }
+  return true;
+}
+
+// use:  matchUnitigs(s,l,v)
+// pre:  v is initialized
+// post: v contains all equiv classes for the k-mers in s
+//
+// Each dbg.findUnitig() call matches a whole stretch of the read against
+// one unitig, and the traversal then continues right after that stretch.
+// A hit is emitted for the first k-mer of the stretch, for the first k-mer
+// of every mosaic EC block the stretch crosses into, and for its last
+// k-mer (so that the range of support covers the whole stretch).
+void KmerIndex::matchUnitigs(const char *s, int l, std::vector<std::pair<const_UnitigMap<Node>, int>>& v, bool partial,
+                              int start, const const_UnitigMap<Node>& start_um) const {
+  Roaring rtmp;
+  // the D-list targets take part in intersections under dfk_onlist, which
+  // RunningEC does not follow
+  bool early = early_exit && !dfk_onlist;
+  RunningEC running;
+
+  // push the hit for the k-mer at unitig position dist, read position pos;
+  // returns false if a partial match has run out of transcripts
+  auto add_hit = [&](const const_UnitigMap<Node>& um, size_t dist, int pos) {
+    const_UnitigMap<Node> hit(um);
+    hit.dist = dist;
+    hit.len = 1;
+    if (partial) {
+      const auto& rtmp2 = hit.getData()->ec[dist].getIndices();
+      if (rtmp.isEmpty()) {
+        if (!rtmp2.isEmpty()) rtmp = rtmp2;
+      } else if (!rtmp2.isEmpty()) {
+        rtmp &= rtmp2;
+        if (rtmp.isEmpty()) {
+          return false;
+        }
+      }
+    }
+    v.push_back({hit, pos});
+    return true;
+  };
+
+  int proc = start;
+  while (proc <= l - k) {
+    const_UnitigMap<Node> um = (proc == start && !start_um.isEmpty) ? start_um : dbg.findUnitig(s, proc, l);
+    if (um.isEmpty) {
+      ++proc;
+      continue;
+    }
+
+    const Node* n = um.getData();
+    // the i-th k-mer of the stretch sits at this position on the unitig
+    auto udist = [&](size_t i) {
+      return um.strand ? um.dist + i : um.dist + um.len - 1 - i;
+    };
+
+    size_t i = 0;
+    while (i < um.len) {
+      size_t d = udist(i);
+      if (!add_hit(um, d, proc + i)) {
+        v.clear();
+        return;
+      }
+      // skip the rest of this mosaic EC block
+      auto b = n->get_mc_contig(d);
+      size_t last = i + (um.strand ? b.second - 1 - d : d - b.first);
+      if (last >= um.len - 1) {
+        if (um.len - 1 > i && !add_hit(um, udist(um.len - 1), proc + um.len - 1)) {
+          v.clear();
+          return;
+        }
+        break;
+      }
+      i = last + 1;
+    }
+
+    proc += um.len;
 
+    if (early && running.settled(v)) {
+      if (running.empty() || confirmTarget(s, l, proc, running.target(), v)) {
+        return;
+      }
+      early = false; // the read disagrees with the target, match all of it
+    }
+  }
+}
+
+void KmerIndex::buildKmerFilter() {
+  kmer_filter = KmerBloomFilter(dbg.nbKmers());
+  for (const auto& um : dbg) {
+    for (size_t i = 0; i < um.size - k + 1; ++i) {
+      kmer_filter.insert(um.getUnitigKmer(i));
+    }
+  }
+  std::cerr << "[build] k-mer Bloom filter: " << pretty_num(kmer_filter.sizeInBytes()) << " bytes" << std::endl;
+}
+
+int KmerIndex::mapPair(const char *s1, int l1, const char *s2, int l2) const {
   KmerIterator kit1(s1), kit_end;
   const_UnitigMap<Node> um1, um2;
 
@@ -1280,13 +1478,6 @@ int KmerIndex::mapPair(const char *s1, int l1, const char *s2, int l2) const {
     um1 = dbg.find(kit1->first);
     if (!um1.isEmpty) {
       found1 = true;
-      if (um1.strand)
-        p1 = um1.dist - kit1->second;
-      else
-      if (um1.strand)
-        p1 = um1.dist - kit1->second;
-      else
-        p1 = um1.dist + k + kit1->second;
       break;
     }
   }
@@ -1302,10 +1493,6 @@ int KmerIndex::mapPair(const char *s1, int l1, const char *s2, int l2) const {
     um2 = dbg.find(kit2->first);
     if (!um2.isEmpty) {
       found2 = true;
-      if (um2.strand)
-        p2 = um2.dist - kit2->second;
-      else
-        p2 = um2.dist + k + kit2->second;
       break;
     }
   }
@@ -1314,6 +1501,43 @@ int KmerIndex::mapPair(const char *s1, int l1, const char *s2, int l2) const {
     return -1;
   }
 
+  return mapPair(um1, kit1->second, um2, kit2->second);
+}
+
+int KmerIndex::mapPair(const std::vector<std::pair<const_UnitigMap<Node>, int>>& v1, const std::vector<std::pair<const_UnitigMap<Node>, int>>& v2) const {
+  if (v1.empty() || v2.empty()) {
+    return -1;
+  }
+  // match() has looked the k-mers up in read order, so the first mapping
+  // k-mer of a mate is its hit with the smallest position
+  auto first1 = v1.begin(), first2 = v2.begin();
+  for (auto it = v1.begin(); it != v1.end(); ++it) {
+    if (it->second < first1->second) {
+      first1 = it;
+    }
+  }
+  for (auto it = v2.begin(); it != v2.end(); ++it) {
+    if (it->second < first2->second) {
+      first2 = it;
+    }
+  }
+  // a hit can cover a stretch of len k-mers, on the reverse strand dist
+  // is where the stretch ends rather than where the read's k-mer is
+  const_UnitigMap<Node> um1(first1->first), um2(first2->first);
+  if (!um1.strand) {
+    um1.dist += um1.len - 1;
+  }
+  if (!um2.strand) {
+    um2.dist += um2.len - 1;
+  }
+  um1.len = um2.len = 1;
+  return mapPair(um1, first1->second, um2, first2->second);
+}
+
+int KmerIndex::mapPair(const const_UnitigMap<Node>& um1, int pos1, const const_UnitigMap<Node>& um2, int pos2) const {
+  int p1 = (um1.strand) ? um1.dist - pos1 : um1.dist + k + pos1;
+  int p2 = (um2.strand) ? um2.dist - pos2 : um2.dist + k + pos2;
+
   // We want the reads to map within the same EC block on the same unitig
   if (!um1.isSameReferenceUnitig(um2) ||
       !(um1.getData()->ec[um1.dist] == um2.getData()->ec[um2.dist])) {
@@ -1343,33 +1567,6 @@ int KmerIndex::mapPair(const char *s1, int l1, const char *s2, int l2) const {
 void KmerIndex::match(const char *s, int l, std::vector<std::pair<const_UnitigMap<Node>, int>>& v, bool partial, bool cfc) const{
   const Node* n;
 
-  // TODO:
-  // Rework KmerIndex::match() such that it uses the following type of logic
-  // rather than the jumping logic below
-
-  /*
-  size_t proc = 0;
-  while (proc < l - k + 1) {
-    const_UnitigMap<Node> um = dbg.findUnitig(s, proc, l);
-    if (um.isEmpty) {
-      proc++;
-      continue;
-    }
-
-    n = um.getData();
-    uint32_t curr_ec = n->ec[um.dist];
-    v.emplace_back(um, proc);
-    // Add one entry to v for each EC that is part of the mosaic EC of the contig.
-    for (size_t i = 0; i < um.len; ++i) {
-      if (n->ec[um.dist + i] != curr_ec) {
-        curr_ec = n->ec[um.dist + i];
-        v.emplace_back(dbg.find(um.getUnitigKmer(um.dist + i)), proc + i);
-      }
-    }
-    proc += um.len;
-  }
-  */
-
   std::string s_string;
   if (cfc) {
     // translate nucleotide sequence to comma-free code (cfc)
@@ -1382,261 +1579,45 @@ void KmerIndex::match(const char *s, int l, std::vector<std::pair<const_UnitigMa
     // // reset countNonNN
     // ::countNonNN = 0;
   }
-
-  //Below is initial refactoring of match that needs to be adapted to exactly match prior implementation 
-  /***
-  size_t proc = 0;
-  while (proc < l - k) {
-    const_UnitigMap<Node> um = dbg.findUnitig(s, proc, l);
-    if (um.isEmpty || um.len == 0) {
-      proc++;
-      continue;
-    }      
-    v.push_back({um, proc});
- 
-    n = um.getData();
-    // Add one entry to v for each EC that is part of the mosaic EC of the contig.
-    size_t curr_pos = um.dist;
-    size_t contig_start = 0, contig_length = um.size - k + 1;
-    auto p = n->get_mc_contig(um.dist);
-    while (curr_pos < um.dist + um.len) {
-        //std::cout << "curr_pos: " << curr_pos << std::endl; 
-        p = n->get_mc_contig(curr_pos);
-        contig_start = p.first;
-        size_t contig_length = p.second - contig_start;
-        // Looks like kallisto thinks that canonical kmer means forward strand?
-        //bool forward = (um.strand == (kit->first == kit->first.rep()));
-        bool forward = um.strand;
-        int dist = (forward) ? (contig_length - 1 - (um.dist - contig_start)) : um.dist - contig_start;
-        
-        // see if we can skip ahead
-        int nextPos; 
-        int midPos=0;
-        if (dist >= 2) {
-          // where should we jump to?
-          nextPos = curr_pos+dist; // default jump
-          if (dist > 4) {
-              midPos = curr_pos+dist/2; 
-          }
-          if (nextPos > l-k) {
-            // if we can jump beyond the read, check the end
-            nextPos = l-k;
-          }
-        } else {
-          nextPos = curr_pos+1;
-        }
-        if (!(n->ec[curr_pos] == n->ec[nextPos])) { //um.getData()->ec[(um.dist + i)].getIndices() == curr_ec)) {
-            curr_pos = nextPos;
-            v.push_back({dbg.find(um.getUnitigKmer(curr_pos)), curr_pos});
-            //std::cout << "Is it ever entering here?" << std::endl; 
-        } else {
-            curr_pos = nextPos; 
-        }
-
-        if (midPos != 0) {
-            if (!(n->ec[curr_pos] == n->ec[midPos])) { //um.getData()->ec[(um.dist + i)].getIndices() == curr_ec)) {
-                v.push_back({dbg.find(um.getUnitigKmer(midPos)), midPos});
-                //std::cout << "Is it ever entering here?" << std::endl; 
-            }
+  // the comma-free code is 3*floor(l/3) long
+  const int len = cfc ? s_string.size() : l;
+
+  // drop reads with no k-mer in dbg; only k-mers that pass the filter are
+  // looked up. Every k-mer before the first one found is then known to be
+  // missing, so the traversal skips their lookups and reuses the first one
+  int first_pos = 0;
+  const_UnitigMap<Node> first_um;
+  if (!kmer_filter.empty()) {
+    KmerIterator kit(s), kit_end;
+    for (; kit != kit_end; ++kit) {
+      if (kmer_filter.contains(kit->first)) {
+        first_um = unitig_match ? dbg.findUnitig(s, kit->second, len) : dbg.find(kit->first);
+        if (!first_um.isEmpty) {
+          break;
         }
+      }
+    }
+    if (kit == kit_end) {
+      return;
     }
-    //std::cout << "proc: " << proc << std::endl; 
-    proc++; //= um.len;
+    first_pos = kit->second;
   }
-  ***/
-
-  //Refactoring for exact match with jumping logic with proc instead of kmer iterator 
-  /***
-  Roaring rtmp;
-  size_t proc = 0;
-  while (proc < l - k + 1) { //should be + 2?
-    const_UnitigMap<Node> um = dbg.findUnitig(s, proc, l);     
-
-    n = um.getData();
-
-    int pos = proc; //kit->second;
-    if (!um.isEmpty) {
-      
-      if (partial) {
-        if (rtmp.isEmpty()) {
-          const auto& rtmp2 = um.getData()->ec[um.dist].getIndices();
-          if (!rtmp2.isEmpty()) rtmp = std::move(rtmp2);
-        } else {
-          const auto& rtmp2 = um.getData()->ec[um.dist].getIndices();
-          if (!rtmp2.isEmpty()) rtmp &= rtmp2;
-          if (rtmp.isEmpty()) {
-            v.clear();
-            return;
-          }
-        }
-      }
-
-      v.push_back({um, pos});
-
-      // Find start and end of O.G. kallisto contig w.r.t. the bifrost-kallisto
-      // unitig
-      size_t contig_start = 0, contig_length = um.size - k + 1;
-      auto p = n->get_mc_contig(um.dist);
-      contig_start += p.first;
-      contig_length = p.second - contig_start;
-
-      // Looks like kallisto thinks that canonical kmer means forward strand?
-      //bool forward = (um.strand == (kit->first == kit->first.rep()));
-      bool forward = um.strand;
-      int dist = (forward) ? (contig_length - 1 - (um.dist - contig_start)) : um.dist - contig_start;
-
-      // see if we can skip ahead
-      if (dist >= 2) {
-        // where should we jump to?
-        int nextPos = pos+dist; // default jump
-
-        if (pos + dist >= l-k) { //should be + 1?
-          // if we can jump beyond the read, check the end
-          nextPos = l-k; //should be +1?
-        }
-
-        // check next position
-        //KmerIterator kit2(kit);
-        //kit2 += nextPos-pos;
-        if (nextPos < l-k) { //should be +1?
-          const_UnitigMap<Node> um2 = dbg.findUnitig(s, nextPos, l); //const_UnitigMap<Node> um2 = dbg.find(kit2->first);
-          bool found2 = false;
-          int  found2pos = pos+dist;
-          if (um2.isEmpty) {
-            found2=true;
-            found2pos = pos;
-          } else if (um.isSameReferenceUnitig(um2) &&
-                     n->ec[um.dist] == um2.getData()->ec[um2.dist]) {
-            // um and um2 are on the same unitig and also share the same EC
-            found2=true;
-            found2pos = pos+dist;
-          }
-          if (found2) {
-            // great, a match (or nothing) see if we can move the k-mer forward
-            if (found2pos >= l-k) { //should be +1?
-              v.push_back({um, l-k}); // push back a fake position //should be +2?
-              break; //
-            } else {
-              v.push_back({um, found2pos});
-              proc=found2pos;//kit = kit2; // move iterator to this new position
-            }
-          } else {
-            // this is weird, let's try the middle k-mer
-            bool foundMiddle = false;
-            if (dist > 4) {
-              int middlePos = (pos + nextPos)/2;
-              int middleContig = -1;
-              int found3pos = middlePos+dist; //formerly pos+dist which is same as found2pos, but I think should be middlePos+dist
-              //KmerIterator kit3(kit);
-              //kit3 += middlePos-pos;
-
-              if (found3pos < l-k) {
-                const_UnitigMap<Node> um3 = dbg.findUnitig(s, middlePos, l); //const_UnitigMap<Node> um3 = dbg.find(kit3->first);
-                if (!um3.isEmpty) {
-                  if (um.isSameReferenceUnitig(um3) &&
-                      n->ec[um.dist] == um3.getData()->ec[um3.dist]) {
-                    foundMiddle = true;
-                    found3pos = middlePos;
-                  } else if (um2.isSameReferenceUnitig(um3) &&
-                             um2.getData()->ec[um2.dist] == um3.getData()->ec[um3.dist]) {
-                    foundMiddle = true;
-                    found3pos = pos+dist;
-                  }
-                }
-
-                if (foundMiddle) {
-                  if (partial) {
-                    if (rtmp.isEmpty()) {
-                      const auto& rtmp2 = um3.getData()->ec[um3.dist].getIndices();
-                      if (!rtmp2.isEmpty()) rtmp = std::move(rtmp2);
-                    } else {
-                      const auto& rtmp2 = um3.getData()->ec[um3.dist].getIndices();
-                      if (!rtmp2.isEmpty()) rtmp &= rtmp2;
-                      if (rtmp.isEmpty()) {
-                        v.clear();
-                        return;
-                      }
-                    }
-                  }
-                  v.push_back({um3, found3pos});
-                  if (nextPos >= l-k) { //should be +2?
-                    break;
-                  } else {
-                    proc=found2pos;//kit = kit2;
-                  }
-                }
-              }
-            }
 
-            if (!foundMiddle) {
-              ++proc; //++kit;
-              // backup plan, let's play it safe and search incrementally for the rest, until nextStop
-              for (int j = 0; proc <= nextPos; ++proc,++j) {
-                if (j==skip) {
-                  j=0;
-                }
-                if (j==0) {
-                  // need to check it
-                  const_UnitigMap<Node> um4 = dbg.findUnitig(s, proc, l);;
-                  if (!um4.isEmpty) {
-                    // if k-mer found
-                    if (partial) {
-		      if (rtmp.isEmpty()) {
-                        const auto& rtmp2 = um4.getData()->ec[um4.dist].getIndices();
-                        if (!rtmp2.isEmpty()) rtmp = std::move(rtmp2);
-                      } else {
-                        const auto& rtmp2 = um4.getData()->ec[um4.dist].getIndices();
-                        if (!rtmp2.isEmpty()) rtmp &= rtmp2;
-                        if (rtmp.isEmpty()) {
-                          v.clear();
-                          return;
-                        }
-                      }    
-                    }
-                    v.push_back({um4, proc}); // add equivalence class, and position
-                  }
-                }
-              }
-	      proc = l; //this is checking if jump logic works how I am suspecting it is working 
-            } 
-          }
-        }
-      //} //NOTE!!! When this if is outside of the check if nextPos is at the end of the kmer, then we allow for incrementally searching which is the correct behavior? 
-      else {
-        // the sequence is messed up at this point, let's just take the match
-        //v.push_back({dbGraph.ecs[val.contig], l-k});
-        break;
-      }	
-    } //adding this corresponding to NOTE!!!
-  }
-  if (um.len == 0) { 
-    proc++;
-  } else {
-    proc+=um.len; 
+  if (unitig_match) {
+    matchUnitigs(s, len, v, partial, first_pos, first_um);
+    return;
   }
-}
-***/
 
 //THIS IS THE REFACTORED AND EDITED VERSION THAT PERFORMS WELL FOR PACBIO READS BUT IS SUBPAR FOR ONT STILL 
 Roaring rtmp;
 KmerIterator kit(s), kit_end;
 size_t proc = 15;
 size_t matches = 0; 
+bool early = early_exit && !dfk_onlist; // see matchUnitigs
+RunningEC running;
 
-/***
-while (proc < l - k - 1) {
-	const_UnitigMap<Node> fum = dbg.findUnitig(s, proc, l);  
-	if (!fum.isEmpty && fum.len > 0) {
-		v.push_back({fum, proc});
-		matches++; 
-		proc += fum.len + 1; //fum.len + 1
-	} else {
-		proc+= (int)(l/10);
-	}
-}
-***/
 while (kit != kit_end) { //should be + 2?
-    const_UnitigMap<Node> fum = dbg.findUnitig(s, proc, l);  
+    const_UnitigMap<Node> fum = ((int) proc < first_pos) ? const_UnitigMap<Node>() : dbg.findUnitig(s, proc, len);
     if (!fum.isEmpty && fum.len > 0) {
 	v.push_back({fum, proc});
 	//matches++; 
@@ -1644,7 +1625,8 @@ while (kit != kit_end) { //should be + 2?
     } else {
 	proc+= 10;
     }
-    const_UnitigMap<Node> um = dbg.find(kit->first);
+    const_UnitigMap<Node> um = (kit->second < first_pos) ? const_UnitigMap<Node>()
+                             : (kit->second == first_pos && !first_um.isEmpty) ? first_um : dbg.find(kit->first);
 	
     n = um.getData();
 
@@ -1818,6 +1800,13 @@ while (kit != kit_end) { //should be + 2?
       //}	
     //}  //adding this corresponding to NOTE!!!
   } 
+  if (early && running.settled(v)) {
+    int from = std::max(kit != kit_end ? kit->second + 1 : len, (int) proc);
+    if (running.empty() || confirmTarget(s, len, from, running.target(), v)) {
+      return;
+    }
+    early = false; // the read disagrees with the target, match all of it
+  }
   kit++; 
   //proc++; 
 }
@@ -1826,369 +1815,6 @@ while (kit != kit_end) { //should be + 2?
 //	v.clear(); 
 //}
 
-//Refactored for exact match with jumping logic with kmer iterator
-/***
-Roaring rtmp;
-KmerIterator kit(s), kit_end;
-size_t proc = 0;
-while (kit != kit_end) { //should be + 2?
-    const_UnitigMap<Node> um = dbg.find(kit->first);//dbg.findUnitig(s, proc, l);     
-
-    n = um.getData();
-
-    int pos = kit->second;
-    if (!um.isEmpty) {
-      
-      if (partial) {
-        if (rtmp.isEmpty()) {
-          const auto& rtmp2 = um.getData()->ec[um.dist].getIndices();
-          if (!rtmp2.isEmpty()) rtmp = std::move(rtmp2);
-        } else {
-          const auto& rtmp2 = um.getData()->ec[um.dist].getIndices();
-          if (!rtmp2.isEmpty()) rtmp &= rtmp2;
-          if (rtmp.isEmpty()) {
-            v.clear();
-            return;
-          }
-        }
-      }
-
-      v.push_back({um, kit->second});
-
-      // Find start and end of O.G. kallisto contig w.r.t. the bifrost-kallisto
-      // unitig
-      size_t contig_start = 0, contig_length = um.size - k + 1;
-      auto p = n->get_mc_contig(um.dist);
-      contig_start += p.first;
-      contig_length = p.second - contig_start;
-
-      // Looks like kallisto thinks that canonical kmer means forward strand?
-      //bool forward = (um.strand == (kit->first == kit->first.rep()));
-      bool forward = um.strand;
-      int dist = (forward) ? (contig_length - 1 - (um.dist - contig_start)) : um.dist - contig_start;
-
-      // see if we can skip ahead
-      if (dist >= 2) {
-        // where should we jump to?
-        int nextPos = pos+dist; // default jump
-
-        if (pos + dist >= l-k) { //should be + 1?
-          // if we can jump beyond the read, check the end
-          nextPos = l-k; //should be +1?
-        }
-
-        // check next position
-        KmerIterator kit2(kit);
-        kit2 += nextPos-pos;
-        if (kit2 != kit_end) { //(nextPos < l-k) { //should be +1?
-          const_UnitigMap<Node> um2 = dbg.find(kit2->first); //const_UnitigMap<Node> um2 = dbg.findUnitig(s, nextPos, l); 
-          bool found2 = false;
-          int  found2pos = pos+dist;
-          if (um2.isEmpty) {
-            found2=true;
-            found2pos = pos;
-          } else if (um.isSameReferenceUnitig(um2) &&
-                     n->ec[um.dist] == um2.getData()->ec[um2.dist]) {
-            // um and um2 are on the same unitig and also share the same EC
-            found2=true;
-            found2pos = pos+dist;
-          }
-          if (found2) {
-            // great, a match (or nothing) see if we can move the k-mer forward
-            if (found2pos >= l-k) { //should be +1?
-              v.push_back({um, l-k}); // push back a fake position //should be +2?
-              break; //
-            } else {
-              v.push_back({um, found2pos});
-              proc=found2pos;
-	      kit = kit2; // move iterator to this new position
-            }
-          } else {
-            // this is weird, let's try the middle k-mer
-            bool foundMiddle = false;
-            if (dist > 4) {
-              int middlePos = (pos + nextPos)/2;
-              int middleContig = -1;
-              int found3pos = pos + dist; //middlePos+dist; //formerly pos+dist which is same as found2pos, but I think should be middlePos+dist
-              KmerIterator kit3(kit);
-              kit3 += middlePos-pos;
-
-              if (kit3 != kit_end) { //(found3pos < l-k) {
-                const_UnitigMap<Node> um3 = dbg.find(kit3->first); 
-		//const_UnitigMap<Node> um3 = dbg.findUnitig(s, middlePos, l); 
-		if (!um3.isEmpty) {
-                  if (um.isSameReferenceUnitig(um3) &&
-                      n->ec[um.dist] == um3.getData()->ec[um3.dist]) {
-                    foundMiddle = true;
-                    found3pos = middlePos;
-                  } else if (um2.isSameReferenceUnitig(um3) &&
-                             um2.getData()->ec[um2.dist] == um3.getData()->ec[um3.dist]) {
-                    foundMiddle = true;
-                    found3pos = pos+dist;
-                  }
-                }
-
-                if (foundMiddle) {
-                  if (partial) {
-                    if (rtmp.isEmpty()) {
-                      const auto& rtmp2 = um3.getData()->ec[um3.dist].getIndices();
-                      if (!rtmp2.isEmpty()) rtmp = std::move(rtmp2);
-                    } else {
-                      const auto& rtmp2 = um3.getData()->ec[um3.dist].getIndices();
-                      if (!rtmp2.isEmpty()) rtmp &= rtmp2;
-                      if (rtmp.isEmpty()) {
-                        v.clear();
-                        return;
-                      }
-                    }
-                  }
-                  v.push_back({um3, found3pos});
-                  if (nextPos >= l-k) { //should be +2?
-                    break;
-                  } else {
-                    proc=found2pos;
-		    kit = kit2;
-                  }
-                }
-              }
-            }
-
-            if (!foundMiddle) {
-              ++proc; 
-	      ++kit;
-              // backup plan, let's play it safe and search incrementally for the rest, until nextStop
-              for (int j = 0; kit != kit_end; ++kit,++j) {
-                if (j==skip) {
-                  j=0;
-                }
-                if (j==0) {
-                  // need to check it
-		  const_UnitigMap<Node> um4 = dbg.find(kit->first);
-                  //const_UnitigMap<Node> um4 = dbg.findUnitig(s, proc, l);;
-                  if (!um4.isEmpty) {
-                    // if k-mer found
-                    if (partial) {
-		      if (rtmp.isEmpty()) {
-                        const auto& rtmp2 = um4.getData()->ec[um4.dist].getIndices();
-                        if (!rtmp2.isEmpty()) rtmp = std::move(rtmp2);
-                      } else {
-                        const auto& rtmp2 = um4.getData()->ec[um4.dist].getIndices();
-                        if (!rtmp2.isEmpty()) rtmp &= rtmp2;
-                        if (rtmp.isEmpty()) {
-                          v.clear();
-                          return;
-                        }
-                      }    
-                    }
-                    v.push_back({um4, proc}); // add equivalence class, and position
-                  }
-                }
-		if (kit->second >= nextPos) {
-		  break; 
-		}
-		++proc; 
-              }
-	      //kit += (l-k)-nextPos;
-	      //proc = l; //this is checking if jump logic works how I am suspecting it is working 
-            } 
-          }
-        }
-      //} //NOTE!!! When this if is outside of the check if nextPos is at the end of the kmer, then we allow for incrementally searching which is the correct behavior? 
-      else {
-        // the sequence is messed up at this point, let's just take the match
-        //v.push_back({dbGraph.ecs[val.contig], l-k});
-        break;
-      }	
-    }  //adding this corresponding to NOTE!!!
-  } 
-  kit++; 
-  proc++; 
-}
-***/
-/*** else {
-    proc++;
-  }***/
-  
-
-  /***
-  KmerIterator kit(s), kit_end;
-  bool backOff = false;
-  int nextPos = 0; // nextPosition to check
-  Roaring rtmp;
-  
-  for (int i = 0;  kit != kit_end; ++i,++kit) {
-
-    // need to check it
-    const_UnitigMap<Node> um = dbg.find(kit->first);
-    n = um.getData();
-
-    int pos = kit->second;
-
-    if (!um.isEmpty) {
-      
-      if (partial) {
-        if (rtmp.isEmpty()) {
-          const auto& rtmp2 = um.getData()->ec[um.dist].getIndices();
-          if (!rtmp2.isEmpty()) rtmp = std::move(rtmp2);
-        } else {
-          const auto& rtmp2 = um.getData()->ec[um.dist].getIndices();
-          if (!rtmp2.isEmpty()) rtmp &= rtmp2;
-          if (rtmp.isEmpty()) {
-            v.clear();
-            return;
-          }
-        }
-      }
-
-      v.push_back({um, kit->second});
-
-      // Find start and end of O.G. kallisto contig w.r.t. the bifrost-kallisto
-      // unitig
-      size_t contig_start = 0, contig_length = um.size - k + 1;
-      auto p = n->get_mc_contig(um.dist);
-      contig_start += p.first;
-      contig_length = p.second - contig_start;
-
-      // Looks like kallisto thinks that canonical kmer means forward strand?
-      //bool forward = (um.strand == (kit->first == kit->first.rep()));
-      bool forward = um.strand;
-      int dist = (forward) ? (contig_length - 1 - (um.dist - contig_start)) : um.dist - contig_start;
-
-      // see if we can skip ahead
-      if (dist >= 2) {
-        // where should we jump to?
-        int nextPos = pos+dist; // default jump
-
-        if (pos + dist >= l-k) {
-          // if we can jump beyond the read, check the end
-          nextPos = l-k;
-        }
-
-        // check next position
-        KmerIterator kit2(kit);
-        kit2 += nextPos-pos;
-        if (kit2 != kit_end) {
-          const_UnitigMap<Node> um2 = dbg.find(kit2->first);
-          bool found2 = false;
-          int  found2pos = pos+dist;
-          if (um2.isEmpty) {
-            found2=true;
-            found2pos = pos;
-          } else if (um.isSameReferenceUnitig(um2) &&
-                     n->ec[um.dist] == um2.getData()->ec[um2.dist]) {
-            // um and um2 are on the same unitig and also share the same EC
-            found2=true;
-            found2pos = pos+dist;
-          }
-          if (found2) {
-            // great, a match (or nothing) see if we can move the k-mer forward
-            if (found2pos >= l-k) {
-              v.push_back({um, l-k}); // push back a fake position
-              break; //
-            } else {
-              v.push_back({um, found2pos});
-              kit = kit2; // move iterator to this new position
-            }
-          } else {
-            // this is weird, let's try the middle k-mer
-            bool foundMiddle = false;
-            if (dist > 4) {
-              int middlePos = (pos + nextPos)/2;
-              int middleContig = -1;
-              int found3pos = pos+dist;
-              KmerIterator kit3(kit);
-              kit3 += middlePos-pos;
-
-              if (kit3 != kit_end) {
-                const_UnitigMap<Node> um3 = dbg.find(kit3->first);
-                if (!um3.isEmpty) {
-                  if (um.isSameReferenceUnitig(um3) &&
-                      n->ec[um.dist] == um3.getData()->ec[um3.dist]) {
-                    foundMiddle = true;
-                    found3pos = middlePos;
-                  } else if (um2.isSameReferenceUnitig(um3) &&
-                             um2.getData()->ec[um2.dist] == um3.getData()->ec[um3.dist]) {
-                    foundMiddle = true;
-                    found3pos = pos+dist;
-                  }
-                }
-
-                if (foundMiddle) {
-                  if (partial) {
-                    if (rtmp.isEmpty()) {
-                      const auto& rtmp2 = um3.getData()->ec[um3.dist].getIndices();
-                      if (!rtmp2.isEmpty()) rtmp = std::move(rtmp2);
-                    } else {
-                      const auto& rtmp2 = um3.getData()->ec[um3.dist].getIndices();
-                      if (!rtmp2.isEmpty()) rtmp &= rtmp2;
-                      if (rtmp.isEmpty()) {
-                        v.clear();
-                        return;
-                      }
-                    }
-                  }
-                  v.push_back({um3, found3pos});
-                  if (nextPos >= l-k) {
-                    break;
-                  } else {
-                    kit = kit2;
-                  }
-                }
-              }
-            }
-
-            if (!foundMiddle) {
-              ++kit;
-              backOff = true;
-              goto donejumping; // sue me Dijkstra!
-            }
-          }
-        } else {
-          // the sequence is messed up at this point, let's just take the match
-          //v.push_back({dbGraph.ecs[val.contig], l-k});
-          break;
-        }
-      }
-    }
-
-donejumping:
-
-    if (backOff) {
-      
-    // backup plan, let's play it safe and search incrementally for the rest, until nextStop
-      for (int j = 0; kit != kit_end; ++kit,++j) {
-        if (j==skip) {
-          j=0;
-        }
-        if (j==0) {
-          // need to check it
-          const_UnitigMap<Node> um4 = dbg.find(kit->first);
-          if (!um4.isEmpty) {
-            // if k-mer found
-            if (partial) {
-              if (rtmp.isEmpty()) {
-                const auto& rtmp2 = um4.getData()->ec[um4.dist].getIndices();
-                if (!rtmp2.isEmpty()) rtmp = std::move(rtmp2);
-              } else {
-                const auto& rtmp2 = um4.getData()->ec[um4.dist].getIndices();
-                if (!rtmp2.isEmpty()) rtmp &= rtmp2;
-                if (rtmp.isEmpty()) {
-                  v.clear();
-                  return;
-                }
-              }
-            }
-            v.push_back({um4, kit->second}); // add equivalence class, and position
-          }
-        }
-
-        if (kit->second >= nextPos) {
-          backOff = false;
-          break; // break out of backoff for loop
-        }
-      }
-    } 
-  } ***/
 }
 
 std::pair<int,bool> KmerIndex::findPosition(int tr, Kmer km, int p) const{
@@ -2200,6 +1826,14 @@ std::pair<int,bool> KmerIndex::findPosition(int tr, Kmer km, int p) const{
   }
 }
 
+void KmerIndex::findPositions(const Roaring& u, Kmer km, const_UnitigMap<Node>& um, int p, std::vector<std::pair<int,bool>>& pos) const {
+  pos.clear();
+  pos.reserve(u.cardinality());
+  for (auto tr : u) {
+    pos.push_back(findPosition(tr, km, um, p));
+  }
+}
+
 //use:  (pos,sense) = index.findPosition(tr,km,val,p)
 //pre:  index.kmap[km] == val,
 //      km is the p-th k-mer of a read
@@ -2215,11 +1849,12 @@ std::pair<int,bool> KmerIndex::findPosition(int tr, Kmer km, const_UnitigMap<Nod
   }
   const Node* n = um.getData();
   auto mc = n->get_mc_contig(um.dist);
-  auto ecs = n->ec.get_leading_vals(um.dist);
-  const auto& v_ec = ecs[ecs.size() - 1];
+  // the blocks are looked at in place, see BlockArray::num_leading
+  size_t n_ecs = n->ec.num_leading(um.dist);
+  const auto& v_ec = n->ec.val_at(n_ecs - 1);
   const Roaring& ec = v_ec.getIndices(); // transcripts
   
-  rawpos = v_ec.get(tr, true).minimum();
+  rawpos = v_ec.getFirst(tr);
   trpos = rawpos & bitmask;
   trsense = (rawpos == trpos);
   auto um_dist = um.dist - mc.first; // for mosaic ECs, need to start from beginning of current block, not zero
@@ -2234,8 +1869,8 @@ std::pair<int,bool> KmerIndex::findPosition(int tr, Kmer km, const_UnitigMap<Nod
     if (csense) {
       size_t padding = 0;
       if (trpos == 0) {
-        for (int i = ecs.size()-2; i >= 0; i--) {
-          if (!ecs[i].contains(tr)) {
+        for (int i = n_ecs-2; i >= 0; i--) {
+          if (!n->ec.val_at(i).contains(tr)) {
             padding = mc.first;
             break;
           }
@@ -2249,9 +1884,9 @@ std::pair<int,bool> KmerIndex::findPosition(int tr, Kmer km, const_UnitigMap<Nod
       
       int right_one = 0;
       int left_one = 0;
-      for (int i = ecs.size()-1; i >= 0; i--) {
-        if (i == ecs.size()-1) right_one = mc.second;
-        if (!ecs[i].contains(tr)) { left_one = mc.second; break; }
+      for (int i = n_ecs-1; i >= 0; i--) {
+        if (i == n_ecs-1) right_one = mc.second;
+        if (!n->ec.val_at(i).contains(tr)) { left_one = mc.second; break; }
         else if (i == 0) left_one = 0;
         mc = n->get_mc_contig(mc.first-1); // if goes below 0, it'll be cast as the largest unsigned int and return the right-most block
       }
@@ -2263,22 +1898,21 @@ std::pair<int,bool> KmerIndex::findPosition(int tr, Kmer km, const_UnitigMap<Nod
       int64_t start = mc.first;
       auto mc_ = n->get_mc_contig(mc.first-1);
       start = 0;
-      auto ecs_ = n->ec.get_leading_vals(mc.first-1);
       int curr_mc = 0;
       int left_one = 0;
       int right_one = 0;
       int unmapped_len = 0;
       bool found_first_mapped = false;
       
-      ecs_ = n->ec.get_leading_vals(-1);
-      for (int i = 0; i < ecs_.size(); i++) {
+      size_t n_all = n->ec.num_leading(-1);
+      for (int i = 0; i < n_all; i++) {
         auto mc__ = n->get_mc_contig(curr_mc);
-        if ((!ecs_[i].contains(tr)) && found_first_mapped) {
+        if ((!n->ec.val_at(i).contains(tr)) && found_first_mapped) {
           if (unmapped_len == 0) left_one = mc__.first;
           right_one = mc__.second;
           unmapped_len += (mc__.second - mc__.first);
         }
-        if (ecs_[i].contains(tr)) found_first_mapped = true;
+        if (n->ec.val_at(i).contains(tr)) found_first_mapped = true;
         curr_mc = mc__.second;
       }
       start -= right_one-left_one;
@@ -2288,17 +1922,17 @@ std::pair<int,bool> KmerIndex::findPosition(int tr, Kmer km, const_UnitigMap<Nod
       int curr_mc = 0;
       int left_one = 0;
       int right_one = 0;
-      auto ecs_ = n->ec.get_leading_vals(-1);
+      size_t n_all = n->ec.num_leading(-1);
       int unmapped_len = 0;
       bool found_first_mapped = false;
-      for (int i = 0; i < ecs_.size(); i++) {
+      for (int i = 0; i < n_all; i++) {
         auto mc__ = n->get_mc_contig(curr_mc);
-        if ((!ecs_[i].contains(tr)) && found_first_mapped) {
+        if ((!n->ec.val_at(i).contains(tr)) && found_first_mapped) {
           if (unmapped_len == 0) left_one = mc__.first;
           right_one = mc__.second;
           unmapped_len += (mc__.second - mc__.first);
         }
-        if (ecs_[i].contains(tr)) {
+        if (n->ec.val_at(i).contains(tr)) {
           found_first_mapped = true;
         }
         curr_mc = mc__.second;//+1;
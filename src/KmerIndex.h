@@ -15,6 +15,8 @@
 #include "hash.hpp"
 #include "CompactedDBG.hpp"
 #include "Node.hpp"
+#include "KmerBloomFilter.hpp"
+#include "SmallEC.hpp"
 
 std::string AA_to_cfc (const std::string aa_string);
 std::string nn_to_cfc (const char * s, int l);
@@ -32,21 +34,61 @@ struct TRInfo {
   uint32_t pos;
 };
 
-struct RoaringHasher {
-  size_t operator()(const Roaring& rr) const {
-    uint64_t r = 0;
-    int i=0;
-    for (auto x : rr) {
-      uint64_t t;
-      MurmurHash3_x64_64(&x, sizeof(x), 0, &t);
-      t = (x>>i) | (x<<(64-i));
-      r ^= t;
-      i = (i+1)&63; // (i+1)%64
-    }
-    return r;
+// 64-bit fingerprint of an EC, one pass over its transcripts
+inline uint64_t ec_fingerprint(const Roaring& rr) {
+  uint64_t r = 0x9e3779b97f4a7c15ULL;
+  for (auto x : rr) {
+    r ^= x;
+    r *= 0xff51afd7ed558ccdULL;
+    r ^= r >> 32;
+  }
+  // murmur3 finalizer
+  r ^= r >> 33;
+  r *= 0xff51afd7ed558ccdULL;
+  r ^= r >> 33;
+  r *= 0xc4ceb9fe1a85ec53ULL;
+  r ^= r >> 33;
+  return r;
+}
+
+// Key of the EC map: the transcript set together with its fingerprint and
+// cardinality, computed once when the key is built. Lookups compare those
+// before walking the bitmaps.
+struct ECKey {
+  ECKey(const Roaring& r) : ec(r), fingerprint(ec_fingerprint(r)), card(r.cardinality()) {}
+  ECKey(Roaring&& r) : ec(std::move(r)), fingerprint(ec_fingerprint(ec)), card(ec.cardinality()) {}
+  ECKey(const Roaring& r, uint64_t fingerprint, uint32_t card) : ec(r), fingerprint(fingerprint), card(card) {}
+
+  size_t cardinality() const { return card; }
+
+  Roaring ec;
+  uint64_t fingerprint;
+  uint32_t card;
+};
+
+// Hash and equality for EcMapInv. Both are transparent, so the map can be
+// searched with a plain Roaring without building a key.
+struct ECKeyHasher {
+  using is_transparent = void;
+  using is_avalanching = void;
+  size_t operator()(const ECKey& k) const { return k.fingerprint; }
+  size_t operator()(const Roaring& r) const { return ec_fingerprint(r); }
+};
+
+struct ECKeyEqual {
+  using is_transparent = void;
+  bool operator()(const ECKey& a, const ECKey& b) const {
+    return a.fingerprint == b.fingerprint && a.card == b.card && a.ec == b.ec;
+  }
+  bool operator()(const ECKey& a, const Roaring& b) const {
+    return a.card == b.cardinality() && a.ec == b;
+  }
+  bool operator()(const Roaring& a, const ECKey& b) const {
+    return (*this)(b, a);
   }
 };
-typedef u_map_<Roaring, int32_t, RoaringHasher> EcMapInv;
+
+typedef u_map_<ECKey, int32_t, ECKeyHasher, ECKeyEqual> EcMapInv;
 
 struct KmerEntry {
   int32_t contig; // id of contig
@@ -73,7 +115,7 @@ struct KmerEntry {
 };
 
 struct KmerIndex {
-  KmerIndex(const ProgramOptions& opt) : k(opt.k), num_trans(0), skip(opt.skip), target_seqs_loaded(false) {
+  KmerIndex(const ProgramOptions& opt) : k(opt.k), num_trans(0), skip(opt.skip), unitig_match(opt.unitig_match), early_exit(opt.early_exit), target_seqs_loaded(false), onlist_end(0) {
     //LoadTranscripts(opt.transfasta);
     load_positional_info = opt.bias || opt.pseudobam || opt.genomebam || !opt.single_overhang;
     dfk_onlist = opt.dfk_onlist;
@@ -83,9 +125,22 @@ struct KmerIndex {
 
   std::pair<size_t,size_t> getECInfo() const; // Get max EC size encountered and second element is the number of nodes in which an EC is empty (b/c it was discarded)
   void match(const char *s, int l, std::vector<std::pair<const_UnitigMap<Node>, int>>& v, bool partial = false, bool cfc = false) const;
+  // Unitig-skipping traversal used by match() when unitig_match is set; it
+  // can start at read position start, whose findUnitig() result is start_um
+  void matchUnitigs(const char *s, int l, std::vector<std::pair<const_UnitigMap<Node>, int>>& v, bool partial = false,
+                    int start = 0, const const_UnitigMap<Node>& start_um = const_UnitigMap<Node>()) const;
+  // Looks up a few evenly spaced k-mers of s[from..l) for early_exit; true,
+  // with the hits found pushed to v, if none of them rules out target tr
+  bool confirmTarget(const char *s, int l, int from, uint32_t tr, std::vector<std::pair<const_UnitigMap<Node>, int>>& v) const;
+  // Builds kmer_filter over every k-mer in the graph
+  void buildKmerFilter();
 
 //  bool matchEnd(const char *s, int l, std::vector<std::pair<int, int>>& v, int p) const;
   int mapPair(const char *s1, int l1, const char *s2, int l2) const;
+  // mapPair from the hits match() already found for each mate
+  int mapPair(const std::vector<std::pair<const_UnitigMap<Node>, int>>& v1, const std::vector<std::pair<const_UnitigMap<Node>, int>>& v2) const;
+  // template length given the first mapping k-mer of each mate and its position in the read
+  int mapPair(const const_UnitigMap<Node>& um1, int pos1, const const_UnitigMap<Node>& um2, int pos2) const;
   Roaring intersect(const Roaring& ec, const Roaring& v) const;
 
   void BuildTranscripts(const ProgramOptions& opt, std::ofstream& out);
@@ -99,6 +154,37 @@ struct KmerIndex {
   // Colors the unitigs based on transcript usage. Unitigs may be polychrome,
   // i.e. have more than one color.
   void PopulateMosaicECs(std::vector<std::vector<TRInfo> >& trinfos);
+  // Gives every distinct transcript set among the mosaic EC blocks an
+  // integer id, so blocks can be compared without touching the bitmaps.
+  void internBlockECs();
+  // Sets onlist_end from onlist_sequences
+  void setOnlistEnd();
+
+  // u &= onlist_sequences, returns whether any target was removed. The
+  // D-list targets are numbered after the on-list ones, so this is a look
+  // at the largest id, and never changes u for an index without a D-list.
+  bool maskOnlist(Roaring& u) const {
+    if (u.isEmpty() || (onlist_end > 0 && u.maximum() < onlist_end)) {
+      return false;
+    }
+    if (onlist_end == 0) { // the on-list is not a prefix, or is empty
+      size_t n = u.cardinality();
+      SmallEC::mask(u, onlist_sequences);
+      return u.cardinality() != n;
+    }
+    do {
+      u.remove(u.maximum());
+    } while (!u.isEmpty() && u.maximum() >= onlist_end);
+    return true;
+  }
+
+  // whether u has a target not in onlist_sequences
+  bool hasOfflist(const Roaring& u) const {
+    if (onlist_end == 0) {
+      return u.and_cardinality(onlist_sequences) != u.cardinality();
+    }
+    return !u.isEmpty() && u.maximum() >= onlist_end;
+  }
 
   // output methods
   void write(const std::string& index_out, bool writeKmerTable = true, int threads = 1);
@@ -116,12 +202,17 @@ struct KmerIndex {
   // positional information
   std::pair<int,bool> findPosition(int tr, Kmer km, const_UnitigMap<Node>& um, int p = 0) const;
   std::pair<int,bool> findPosition(int tr, Kmer km, int p) const;
+  // findPosition for every target in u, in order, into pos
+  void findPositions(const Roaring& u, Kmer km, const_UnitigMap<Node>& um, int p, std::vector<std::pair<int,bool>>& pos) const;
 
   int k; // k-mer size used
   int num_trans; // number of targets
   int skip;
+  bool unitig_match; // match() walks whole unitigs instead of jumping k-mer by k-mer
+  bool early_exit; // match() stops once the EC of the read is down to one target or none
 
   CompactedDBG<Node> dbg;
+  KmerBloomFilter kmer_filter; // optional, lets match() drop reads with no k-mer in dbg
   EcMapInv ecmapinv;
   const size_t INDEX_VERSION = 12; // increase this every time you change the file format
 
@@ -136,6 +227,7 @@ struct KmerIndex {
   // Sequences not in off-list: 1
   // Sequences in off-list:     0
   Roaring onlist_sequences;
+  uint32_t onlist_end; // onlist_sequences is [0, onlist_end), 0 if it is not such a range
 };
 
 #endif // KALLISTO_KMERINDEX_H
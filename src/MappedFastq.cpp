@@ -0,0 +1,83 @@
+#include "MappedFastq.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+std::shared_ptr<MappedFastq> MappedFastq::open(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  char c = 0;
+  void* data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+      && pread(fd, &c, 1, 0) == 1 && c == '@') {
+    data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+  return std::shared_ptr<MappedFastq>(new MappedFastq((char*) data, st.st_size));
+}
+
+MappedFastq::MappedFastq(char* data, uint64_t size) :
+  data(data), size(size), pos(0), pending(0), released(0) {}
+
+MappedFastq::~MappedFastq() {
+  munmap(data, size);
+}
+
+int MappedFastq::read(FastqRecord& r) {
+  pending = pos;
+  if (pos >= size) {
+    return -1;
+  }
+  const char* end = data + size;
+  const char* nl[4];
+  const char* p = data + pos;
+  for (int j = 0; j < 4; j++) {
+    nl[j] = (const char*) memchr(p, '\n', end - p);
+    if (nl[j] == nullptr) {
+      return -2;
+    }
+    p = nl[j] + 1;
+  }
+  int l = FastqScanner::parse(data + pos, nl, r);
+  if (l >= 0) {
+    pos = p - data;
+  }
+  return l;
+}
+
+void MappedFastq::pin(uint64_t off) {
+  pinned.insert(off);
+}
+
+void MappedFastq::unpin(uint64_t off) {
+  auto it = pinned.find(off);
+  if (it != pinned.end()) {
+    pinned.erase(it);
+  }
+  release();
+}
+
+void MappedFastq::release() {
+  static const uint64_t page = sysconf(_SC_PAGESIZE);
+  uint64_t limit = pending;
+  if (!pinned.empty()) {
+    limit = std::min(limit, *pinned.begin());
+  }
+  limit -= limit % page;
+  if (limit > released) {
+    madvise(data + released, limit - released, MADV_DONTNEED);
+    released = limit;
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef KALLISTO_MAPPED_FASTQ_H
+#define KALLISTO_MAPPED_FASTQ_H
+
+#include <string>
+#include <set>
+#include <memory>
+#include <cstdint>
+
+#include "FastqScanner.h"
+
+// An uncompressed FASTQ file mapped into memory, with its records parsed
+// in place so readers can be handed pointers into the mapping instead of
+// copies. Nothing in the mapping is '\0' terminated. Pages are unmapped as
+// soon as no batch handed out needs them, see pin().
+class MappedFastq {
+public:
+  // nullptr unless path is a regular file that starts like a FASTQ file
+  static std::shared_ptr<MappedFastq> open(const std::string& path);
+
+  ~MappedFastq();
+
+  // As kseq_read: the length of the sequence of the next record, or -1 at
+  // the end of the file. -2 if the record is not four plain lines, which
+  // kseq can still read starting at begin().
+  int read(FastqRecord& r);
+
+  // where the record last read starts
+  uint64_t begin() const {
+    return pending;
+  }
+
+  // Batches pin the offset of their first record while they are in use;
+  // pages before the first pinned offset, and before the record last read,
+  // are dropped.
+  void pin(uint64_t off);
+  void unpin(uint64_t off);
+
+private:
+  MappedFastq(char* data, uint64_t size);
+
+  void release();
+
+  char* data;
+  uint64_t size;
+  uint64_t pos; // the next record to parse
+  uint64_t pending;
+  uint64_t released; // pages before this are dropped
+  std::multiset<uint64_t> pinned;
+};
+
+#endif // KALLISTO_MAPPED_FASTQ_H
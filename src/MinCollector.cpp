@@ -34,10 +34,10 @@ void MinCollector::init_mean_fl_trunc(double mean, double sd) {
   has_mean_fl_trunc = true;
 }
 
-void includeDList(Roaring& u1, Roaring& u2, const Roaring& onlist_sequences) {
-  if ((u1 & onlist_sequences).cardinality() != u1.cardinality() || (u2 & onlist_sequences).cardinality() != u2.cardinality()) {
-    u1.add(onlist_sequences.cardinality());
-    u2.add(onlist_sequences.cardinality());
+void includeDList(Roaring& u1, Roaring& u2, const KmerIndex& index) {
+  if (index.hasOfflist(u1) || index.hasOfflist(u2)) {
+    u1.add(index.onlist_sequences.cardinality());
+    u2.add(index.onlist_sequences.cardinality());
   }
 }
 
@@ -104,8 +104,10 @@ int MinCollector::intersectKmersCFC(std::vector<std::pair<const_UnitigMap<Node>,
 
 int MinCollector::intersectKmers(std::vector<std::pair<const_UnitigMap<Node>, int32_t>>& v1,
                           std::vector<std::pair<const_UnitigMap<Node>, int32_t>>& v2, bool nonpaired, Roaring& r) const {
-  Roaring u1 = intersectECs(v1);
-  Roaring u2 = intersectECs(v2);
+  ECIntersectionMemo& memo = threadMemo();
+  uint32_t id1, id2;
+  Roaring u1 = intersectECs(v1, memo, id1);
+  Roaring u2 = intersectECs(v2, memo, id2);
 
   if (u1.isEmpty() && u2.isEmpty()) {
     return -1;
@@ -125,10 +127,34 @@ int MinCollector::intersectKmers(std::vector<std::pair<const_UnitigMap<Node>, in
       return -1;
     }
   } else {
-    if (index.dfk_onlist) { // In case we want to not intersect D-list targets
-      includeDList(u1, u2, index.onlist_sequences);
+    const bool memoize = memo.enabled() && id1 != SparseVector<uint32_t>::NO_SET_ID && id2 != SparseVector<uint32_t>::NO_SET_ID;
+    uint32_t id;
+    const Roaring* m = memoize ? memo.find(id1, id2, id) : nullptr;
+    SmallEC s1, s2;
+    if (m != nullptr) {
+      r = *m;
+    } else if (!index.dfk_onlist && s1.assign(u1) && s2.assign(u2)) {
+      // short ECs are intersected inline, often the result is one of them
+      s1.intersect(s2);
+      if (s1.size() == u1.cardinality()) {
+        r = std::move(u1);
+      } else if (s1.size() == s2.size()) {
+        r = std::move(u2);
+      } else {
+        s1.toRoaring(r);
+      }
+      if (memoize) {
+        memo.insert(id1, id2, Roaring(r), id);
+      }
+    } else {
+      if (index.dfk_onlist) { // In case we want to not intersect D-list targets
+        includeDList(u1, u2, index);
+      }
+      r = u1 & u2;
+      if (memoize) {
+        memo.insert(id1, id2, Roaring(r), id);
+      }
     }
-    r = u1 & u2;
   }
 
   if (r.isEmpty()) {
@@ -180,7 +206,7 @@ int MinCollector::increaseCount(const Roaring& r) {
       ret = elem->second;
     } else {
       size_t n_elems = index.ecmapinv.size();
-      index.ecmapinv.insert({r, n_elems});
+      index.ecmapinv.insert({ECKey(r), (int32_t) n_elems});
       counts.push_back(1);
       ret = n_elems;
     }
@@ -200,10 +226,21 @@ struct ComparePairsBySecond {
   }
 };
 
+ECIntersectionMemo& MinCollector::threadMemo() const {
+  static thread_local ECIntersectionMemo memo;
+  memo.reset(memo_owner, ec_memo_size);
+  return memo;
+}
+
 Roaring MinCollector::intersectECs(std::vector<std::pair<const_UnitigMap<Node>, int32_t>>& v) const {
-  Roaring r;
+  uint32_t id;
+  return intersectECs(v, threadMemo(), id);
+}
+
+Roaring MinCollector::intersectECs(std::vector<std::pair<const_UnitigMap<Node>, int32_t>>& v, ECIntersectionMemo& memo, uint32_t& id) const {
+  id = SparseVector<uint32_t>::NO_SET_ID;
   if (v.empty()) {
-    return r;
+    return {};
   }
   sort(v.begin(), v.end(), [&](const std::pair<const_UnitigMap<Node>, int>& a, const std::pair<const_UnitigMap<Node>, int>& b)
        {
@@ -215,52 +252,87 @@ Roaring MinCollector::intersectECs(std::vector<std::pair<const_UnitigMap<Node>,
          }
        }); // sort by contig, and then first position
 
-  r = v[0].first.getData()->ec[v[0].first.dist].getIndices();
-  bool found_nonempty = !r.isEmpty();
-  Roaring lastEC = r;
-  Roaring ec;
+  // find the range of support first, it needs no set operations
+  int minpos = std::numeric_limits<int>::max();
+  int maxpos = 0;
+
+  for (auto& x : v) {
+    minpos = std::min(minpos, x.second);
+    maxpos = std::max(maxpos, x.second);
+  }
+
+  if ((maxpos-minpos + k) < min_range) {
+    return {};
+  }
+
+  // cur is the running intersection: a block EC, a memoized result or r
+  Roaring r;
+  SmallEC small_cur, small_ec;
+  // blocks are compared by interned set id, so tracking the last EC needs no copy
+  const SparseVector<uint32_t>* lastEC = &v[0].first.getData()->ec[v[0].first.dist];
+  const Roaring* cur = &lastEC->getIndices();
+  id = lastEC->getSetId();
+  bool found_nonempty = !cur->isEmpty();
 
   for (int i = 1; i < v.size(); i++) {
 
+    const auto& ec = v[i].first.getData()->ec[v[i].first.dist];
+
     // Find a non-empty EC before we start taking the intersection
     if (!found_nonempty) {
-      r = v[i].first.getData()->ec[v[i].first.dist].getIndices();
-      found_nonempty = !r.isEmpty();
+      cur = &ec.getIndices();
+      id = ec.getSetId();
+      found_nonempty = !cur->isEmpty();
     }
 
     if (!v[i].first.isSameReferenceUnitig(v[i-1].first) ||
-        !(v[i].first.getData()->ec[v[i].first.dist] == v[i-1].first.getData()->ec[v[i-1].first.dist])) {
-
-      ec = v[i].first.getData()->ec[v[i].first.dist].getIndices();
+        !(ec == v[i-1].first.getData()->ec[v[i-1].first.dist])) {
 
       // Don't intersect empty EC (because of thresholding)
-      if (!(ec == lastEC) && !ec.isEmpty()) {
-        if (index.dfk_onlist) { // In case we want to not intersect D-list targets
-          includeDList(r, ec, index.onlist_sequences);
+      if (!(ec == *lastEC) && !ec.isEmpty()) {
+        const bool memoize = memo.enabled() && id != SparseVector<uint32_t>::NO_SET_ID && ec.getSetId() != SparseVector<uint32_t>::NO_SET_ID;
+        uint32_t next_id = SparseVector<uint32_t>::NO_SET_ID;
+        const Roaring* m = memoize ? memo.find(id, ec.getSetId(), next_id) : nullptr;
+        if (m == nullptr && !index.dfk_onlist && small_cur.assign(*cur) && small_ec.assign(ec.getIndices())) {
+          // short ECs are intersected inline; the result is a subset of
+          // both, so when it has the size of either it is that set and
+          // needs no bitmap of its own
+          small_cur.intersect(small_ec);
+          if (small_cur.size() == cur->cardinality()) {
+            m = cur;
+            next_id = id;
+          } else if (small_cur.size() == small_ec.size()) {
+            m = &ec.getIndices();
+            next_id = ec.getSetId();
+          } else {
+            small_cur.toRoaring(r);
+            m = memoize ? memo.insert(id, ec.getSetId(), std::move(r), next_id) : &r;
+          }
+        }
+        if (m == nullptr) {
+          if (cur != &r) {
+            r = *cur;
+          }
+          if (index.dfk_onlist) { // In case we want to not intersect D-list targets
+            Roaring ec_ = ec.getIndices();
+            includeDList(r, ec_, index);
+            r &= ec_;
+          } else {
+            r &= ec.getIndices();
+          }
+          m = memoize ? memo.insert(id, ec.getSetId(), std::move(r), next_id) : &r;
         }
-        r &= ec;
-        if (r.isEmpty()) {
-          return r;
+        cur = m;
+        id = next_id;
+        if (cur->isEmpty()) {
+          return {};
         }
-        lastEC = std::move(ec);
+        lastEC = &ec;
       }
     }
   }
 
-  // find the range of support
-  int minpos = std::numeric_limits<int>::max();
-  int maxpos = 0;
-
-  for (auto& x : v) {
-    minpos = std::min(minpos, x.second);
-    maxpos = std::max(maxpos, x.second);
-  }
-
-  if ((maxpos-minpos + k) < min_range) {
-    return {};
-  }
-
-  return r;
+  return *cur;
 }
 
 
@@ -395,11 +467,11 @@ int hexamerToInt(const char *s, bool revcomp) {
   return hex;
 }
 
-bool MinCollector::countBias(const char *s1, const char *s2, const std::vector<std::pair<const_UnitigMap<Node>,int>> v1, const std::vector<std::pair<const_UnitigMap<Node>,int>> v2, bool paired) {
+bool MinCollector::countBias(const char *s1, const char *s2, const std::vector<std::pair<const_UnitigMap<Node>,int>>& v1, const std::vector<std::pair<const_UnitigMap<Node>,int>>& v2, bool paired) {
   return countBias(s1,s2,v1,v2,paired,bias5);
 }
 
-bool MinCollector::countBias(const char *s1, const char *s2, const std::vector<std::pair<const_UnitigMap<Node>,int>> v1, const std::vector<std::pair<const_UnitigMap<Node>,int>> v2, bool paired, std::vector<int>& biasOut) const {
+bool MinCollector::countBias(const char *s1, const char *s2, const std::vector<std::pair<const_UnitigMap<Node>,int>>& v1, const std::vector<std::pair<const_UnitigMap<Node>,int>>& v2, bool paired, std::vector<int>& biasOut) const {
 
   const int pre = 2, post = 4;
 
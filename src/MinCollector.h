@@ -6,14 +6,76 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <deque>
+#include <atomic>
 #include <unordered_map>
 
 #include "KmerIndex.h"
+#include "SmallEC.hpp"
 #include "weights.h"
 #include "Node.hpp"
 
 const int MAX_FRAG_LEN = 1000;
 
+// Memo of EC intersections for one thread, keyed by the ids of the two
+// sets. Blocks are known by their interned set id (see
+// KmerIndex::internBlockECs) and each result stored here gets an id of
+// its own with the top bit set, so a chain of intersections becomes a
+// chain of lookups. Once it holds `capacity` results it is emptied at the
+// start of the next read; results stay valid until then.
+class ECIntersectionMemo {
+public:
+  static const uint32_t RESULT_ID = 0x80000000;
+
+  ECIntersectionMemo() : owner(0), capacity(0) {}
+
+  // called before each read, the memo only serves one collector at a time
+  void reset(uint64_t owner_, size_t capacity_) {
+    if (owner != owner_ || results.size() >= capacity_) {
+      table.clear();
+      results.clear();
+    }
+    owner = owner_;
+    capacity = capacity_;
+  }
+
+  bool enabled() const {
+    return capacity > 0;
+  }
+
+  // the result of intersecting sets a and b, or nullptr if not known
+  const Roaring* find(uint32_t a, uint32_t b, uint32_t& id) const {
+    auto it = table.find(key(a, b));
+    if (it == table.end()) {
+      return nullptr;
+    }
+    id = it->second;
+    return &results[id & ~RESULT_ID];
+  }
+
+  const Roaring* insert(uint32_t a, uint32_t b, Roaring&& r, uint32_t& id) {
+    id = RESULT_ID | (uint32_t) results.size();
+    results.push_back(std::move(r));
+    table.insert({key(a, b), id});
+    return &results.back();
+  }
+
+  size_t size() const {
+    return results.size();
+  }
+
+private:
+  // intersection is symmetric, so is the key
+  static uint64_t key(uint32_t a, uint32_t b) {
+    return (a < b) ? ((uint64_t) a << 32) | b : ((uint64_t) b << 32) | a;
+  }
+
+  uint64_t owner;
+  size_t capacity;
+  u_map_<uint64_t, uint32_t> table;
+  std::deque<Roaring> results; // deque, so pointers survive push_back
+};
+
 struct MinCollector {
 
   MinCollector(KmerIndex& ind, const ProgramOptions& opt)
@@ -27,6 +89,8 @@ struct MinCollector {
       bias5(4096),
       min_range(opt.min_range),
       k(opt.k),
+      ec_memo_size(opt.ec_memo_size),
+      memo_owner(nextMemoOwner()),
       mean_fl(0.0),
       has_mean_fl(false),
       mean_fl_trunc(MAX_FRAG_LEN, 0.0),
@@ -63,6 +127,10 @@ struct MinCollector {
                     std::vector<std::pair<const_UnitigMap<Node>, int32_t>>& v2, bool nonpaired, Roaring& r) const;
   int findEC(const std::vector<int32_t>& u) const;
 
+  // the calling thread's intersection memo, emptied if it belongs to
+  // another collector or is full
+  ECIntersectionMemo& threadMemo() const;
+
 
   // deprecated
   void write(std::ostream& o) {
@@ -74,8 +142,8 @@ struct MinCollector {
   void loadCounts(ProgramOptions& opt);
 
 
-  bool countBias(const char *s1, const char *s2, const std::vector<std::pair<const_UnitigMap<Node>,int>> v1, const std::vector<std::pair<const_UnitigMap<Node>,int>> v2, bool paired);
-  bool countBias(const char *s1, const char *s2, const std::vector<std::pair<const_UnitigMap<Node>,int>> v1, const std::vector<std::pair<const_UnitigMap<Node>,int>> v2, bool paired, std::vector<int>& biasOut) const;
+  bool countBias(const char *s1, const char *s2, const std::vector<std::pair<const_UnitigMap<Node>,int>>& v1, const std::vector<std::pair<const_UnitigMap<Node>,int>>& v2, bool paired);
+  bool countBias(const char *s1, const char *s2, const std::vector<std::pair<const_UnitigMap<Node>,int>>& v1, const std::vector<std::pair<const_UnitigMap<Node>,int>>& v2, bool paired, std::vector<int>& biasOut) const;
 
   // DEPRECATED
   double get_mean_frag_len(bool lenient = false) const;
@@ -95,6 +163,8 @@ struct MinCollector {
   std::vector<int32_t> bias3, bias5;
   int min_range;
   int k;
+  size_t ec_memo_size; // results held by each thread's ECIntersectionMemo, 0 disables it
+  uint64_t memo_owner;
 
   double mean_fl;
   bool has_mean_fl;
@@ -103,6 +173,16 @@ struct MinCollector {
   bool has_mean_fl_trunc;
 
   mutable int cardinality_clashes;
+
+private:
+  // intersectECs, with id set to the memo id of the result (or
+  // SparseVector<uint32_t>::NO_SET_ID)
+  Roaring intersectECs(std::vector<std::pair<const_UnitigMap<Node>, int32_t>>& v, ECIntersectionMemo& memo, uint32_t& id) const;
+
+  static uint64_t nextMemoOwner() {
+    static std::atomic<uint64_t> n(0);
+    return ++n;
+  }
 };
 
 std::vector<int> intersect(const std::vector<int>& x, const std::vector<int>& y);
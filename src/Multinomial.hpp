@@ -9,7 +9,6 @@ class Multinomial {
         Multinomial(const std::vector<uint32_t>& counts, size_t seed = 42) :
             counts_(counts),
             gen_(seed),
-            dd_(counts_.begin(), counts_.end()),
             n_(0)
         {
             for (auto c : counts_) {
@@ -25,6 +24,11 @@ class Multinomial {
          * understood that only samples that have the same nsamp are
          * comparable. Call sample() for a standard multinomial.
          *
+         * The sample is drawn by conditional binomial splitting: the count of
+         * category i is Binomial(remaining draws, p_i / remaining mass). This
+         * is an exact multinomial sample and costs one binomial draw per
+         * non-zero category instead of one draw per read.
+         *
          * @param nsamp the number of samples. default == -1, which means it
          * will default to n_
          * @return a vector of counts
@@ -35,9 +39,23 @@ class Multinomial {
                 throw std::domain_error("nsamp must be -1 or >=1");
             }
 
-            std::vector<uint32_t> samp(counts_.size(), 0.0);
-            for (auto i = 0; i < nsamp; ++i) {
-                ++samp[dd_(gen_)];
+            std::vector<uint32_t> samp(counts_.size(), 0);
+            int64_t left = nsamp;
+            uint64_t mass = n_;
+            for (size_t i = 0; i < counts_.size() && left > 0; ++i) {
+                if (counts_[i] == 0) {
+                    continue;
+                }
+                if (counts_[i] >= mass) {
+                    samp[i] = left;
+                    break;
+                }
+                double p = static_cast<double>(counts_[i]) / static_cast<double>(mass);
+                std::binomial_distribution<int64_t> bd(left, p);
+                int64_t x = bd(gen_);
+                samp[i] = x;
+                left -= x;
+                mass -= counts_[i];
             }
 
             return samp;
@@ -56,7 +74,6 @@ class Multinomial {
     private:
         const std::vector<uint32_t>& counts_;
         std::default_random_engine gen_;
-        std::discrete_distribution<int> dd_;
         int n_;
 };
 
@@ -0,0 +1,535 @@
+#include "ParallelGzip.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+namespace {
+
+const char index_magic[4] = {'K', 'Z', 'I', 1};
+const size_t window_size = 32768; // the deflate window
+const size_t chunk = 1ULL<<20; // read from the file at a time
+const uint64_t probe_size = 1ULL<<26; // how far open() looks for a second member
+
+// reads [off, off+n) of fd, returns how much of it there is
+size_t readAt(int fd, void* buf, size_t n, uint64_t off) {
+  size_t got = 0;
+  while (got < n) {
+    ssize_t r = pread(fd, (char*) buf + got, n - got, off + got);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      break;
+    }
+    got += r;
+  }
+  return got;
+}
+
+} // namespace
+
+gzFile ParallelGzip::open(const std::string& path, int threads, std::unique_ptr<ParallelGzip>& inflater) {
+  inflater.reset();
+  if (threads > 1) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0) {
+      std::unique_ptr<ParallelGzip> z(new ParallelGzip(path, fd, st.st_size));
+      int p[2];
+      if (z->splittable() && pipe(p) == 0) {
+#ifdef F_SETPIPE_SZ
+        fcntl(p[1], F_SETPIPE_SZ, 1<<20); // fewer wakeups, not needed
+#endif
+        z->start(p[1], threads);
+        inflater = std::move(z);
+        // gzread passes data that is not gzip through unchanged
+        return gzdopen(p[0], "r");
+      }
+    } else if (fd >= 0) {
+      close(fd);
+    }
+  }
+  return gzopen(path.c_str(), "r");
+}
+
+ParallelGzip::ParallelGzip(const std::string& path, int fd, uint64_t size) :
+  path(path), fd(fd), size(size), out_fd(-1), bgzf(false), index_fd(-1),
+  max_segments(0), next_begin(0), next_point(0), planned(false), stop(false) {}
+
+ParallelGzip::~ParallelGzip() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stop = true;
+  }
+  cv.notify_all();
+  for (auto& t : workers) {
+    t.join();
+  }
+  if (writer.joinable()) {
+    writer.join();
+  }
+  close(fd);
+  if (index_fd >= 0) {
+    close(index_fd);
+  }
+}
+
+bool ParallelGzip::splittable() {
+  unsigned char h[18];
+  if (readAt(fd, h, sizeof(h), 0) != sizeof(h)) {
+    return false;
+  }
+  bgzf = true;
+  if (isMember(h)) {
+    return true;
+  }
+  bgzf = false;
+  if (!isMember(h)) {
+    return false; // not gzip
+  }
+  if (loadIndex()) {
+    return true;
+  }
+  uint64_t probe = std::min(size, probe_size);
+  return findMember(1, probe) < probe;
+}
+
+void ParallelGzip::start(int out_fd, int threads) {
+  this->out_fd = out_fd;
+  max_segments = threads + 2;
+  for (int i = 0; i < threads; i++) {
+    workers.emplace_back(&ParallelGzip::work, this);
+  }
+  writer = std::thread(&ParallelGzip::writeOut, this);
+}
+
+bool ParallelGzip::isMember(const unsigned char* p) const {
+  if (p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || (p[3] & 0xe0) != 0) {
+    return false;
+  }
+  if (bgzf) { // an extra field holding only the BC subfield
+    return (p[3] & 4) && p[10] == 6 && p[11] == 0 && p[12] == 'B' && p[13] == 'C' && p[14] == 2 && p[15] == 0;
+  }
+  return (p[8] == 0 || p[8] == 2 || p[8] == 4) && (p[9] <= 13 || p[9] == 255);
+}
+
+uint64_t ParallelGzip::findMember(uint64_t from, uint64_t to) const {
+  const size_t header = 18;
+  std::vector<unsigned char> buf(chunk + header);
+  for (uint64_t off = from; off < to; off += chunk) {
+    size_t n = readAt(fd, buf.data(), buf.size(), off);
+    size_t end = std::min<uint64_t>(std::min(n, chunk), to - off);
+    for (size_t i = 0; i < end; i++) {
+      const unsigned char* p = (const unsigned char*) memchr(&buf[i], 0x1f, end - i);
+      if (p == nullptr) {
+        break;
+      }
+      i = p - buf.data();
+      if (i + header <= n && isMember(p)) {
+        return off + i;
+      }
+    }
+    if (n < buf.size()) {
+      break;
+    }
+  }
+  return to;
+}
+
+bool ParallelGzip::loadIndex() {
+  index_fd = ::open((path + ".kzi").c_str(), O_RDONLY);
+  if (index_fd < 0) {
+    return false;
+  }
+  char magic[4];
+  uint64_t h[3]; // file size, span, number of points
+  uint64_t off = 0;
+  if (readAt(index_fd, magic, 4, off) != 4 || memcmp(magic, index_magic, 4) != 0
+      || readAt(index_fd, h, sizeof(h), off + 4) != sizeof(h) || h[0] != size || h[2] == 0) {
+    std::cerr << "[~warn] ignoring " << path << ".kzi, it is not an index of " << path << std::endl;
+    return false;
+  }
+  off += 4 + sizeof(h);
+  points.resize(h[2]);
+  for (auto& pt : points) {
+    unsigned char bits;
+    if (readAt(index_fd, &pt.in, 8, off) != 8 || readAt(index_fd, &pt.out, 8, off + 8) != 8
+        || readAt(index_fd, &bits, 1, off + 16) != 1 || readAt(index_fd, &pt.window_len, 4, off + 17) != 4
+        || readAt(index_fd, &pt.window_clen, 4, off + 21) != 4) {
+      std::cerr << "[~warn] ignoring " << path << ".kzi, it is truncated" << std::endl;
+      points.clear();
+      return false;
+    }
+    pt.bits = bits;
+    pt.window_offset = off + 25;
+    off = pt.window_offset + pt.window_clen;
+  }
+  return true;
+}
+
+bool ParallelGzip::buildIndex(const std::string& path, size_t span) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Error: could not open " << path << std::endl;
+    return false;
+  }
+  std::ofstream out(path + ".kzi", std::ios::out | std::ios::binary);
+  if (!out.is_open()) {
+    std::cerr << "Error: could not write " << path << ".kzi" << std::endl;
+    close(fd);
+    return false;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  uint64_t h[3] = {(uint64_t) st.st_size, span, 0};
+  out.write(index_magic, 4);
+  out.write((char*) h, sizeof(h));
+
+  // As zlib's examples/zran.c: inflate a block at a time, and at block
+  // boundaries at least span apart record where the block starts and the
+  // 32KB of output before it, which is all inflate needs to resume there.
+  // The output goes round the window buffer.
+  z_stream z;
+  memset(&z, 0, sizeof(z));
+  inflateInit2(&z, 15 + 16);
+  std::vector<unsigned char> in(chunk), window(window_size), ordered(window_size);
+  std::vector<unsigned char> packed(compressBound(window_size));
+  uint64_t pos = 0, totin = 0, totout = 0, last = 0;
+  bool ok = false;
+  int ret = Z_OK;
+  z.avail_out = 0;
+  while (true) {
+    if (z.avail_in == 0) {
+      size_t n = readAt(fd, in.data(), chunk, pos);
+      if (n == 0) {
+        break; // truncated, unless the last member just ended
+      }
+      pos += n;
+      z.next_in = in.data();
+      z.avail_in = n;
+    }
+    if (z.avail_out == 0) {
+      z.next_out = window.data();
+      z.avail_out = window_size;
+    }
+    totin += z.avail_in;
+    totout += z.avail_out;
+    ret = inflate(&z, Z_BLOCK);
+    totin -= z.avail_in;
+    totout -= z.avail_out;
+    if (ret == Z_STREAM_END) {
+      if (z.avail_in == 0 && pos >= (uint64_t) st.st_size) {
+        ok = true;
+        break;
+      }
+      inflateReset(&z); // another member follows
+      continue;
+    }
+    if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      break;
+    }
+    if ((z.data_type & 128) && !(z.data_type & 64) && (h[2] == 0 || totout - last > span)) {
+      uint32_t left = z.avail_out; // the output wraps around at window_size - left
+      memcpy(ordered.data(), window.data() + window_size - left, left);
+      memcpy(ordered.data() + left, window.data(), window_size - left);
+      uint32_t window_len = std::min<uint64_t>(totout, window_size);
+      uLongf clen = packed.size();
+      compress2(packed.data(), &clen, ordered.data() + window_size - window_len, window_len, 1);
+      unsigned char bits = z.data_type & 7;
+      uint32_t clen32 = clen;
+      out.write((char*) &totin, 8);
+      out.write((char*) &totout, 8);
+      out.write((char*) &bits, 1);
+      out.write((char*) &window_len, 4);
+      out.write((char*) &clen32, 4);
+      out.write((char*) packed.data(), clen);
+      h[2]++;
+      last = totout;
+    }
+  }
+  inflateEnd(&z);
+  close(fd);
+
+  if (!ok || h[2] == 0) {
+    std::cerr << "Error: " << path << " is not a complete gzip file" << std::endl;
+    out.close();
+    remove((path + ".kzi").c_str());
+    return false;
+  }
+  out.seekp(4);
+  out.write((char*) h, sizeof(h));
+  out.close();
+  std::cerr << "[gzindex] " << path << ".kzi: " << h[2] << " access points" << std::endl;
+  return true;
+}
+
+bool ParallelGzip::nextSegment(Segment& s) {
+  if (!points.empty()) {
+    if (next_point >= points.size()) {
+      return false;
+    }
+    s.point = next_point;
+    s.begin = points[next_point].in;
+    s.end = (next_point + 1 < points.size()) ? points[next_point+1].in : size;
+    next_point++;
+    return true;
+  }
+  if (next_begin >= size) {
+    return false;
+  }
+  s.point = -1;
+  s.begin = next_begin;
+  s.end = findMember(std::min(size, next_begin + segment_size), size);
+  next_begin = s.end;
+  return true;
+}
+
+bool ParallelGzip::inflateSegment(Segment& s) const {
+  auto sink = [&](const char* p, size_t n) {
+    s.out.insert(s.out.end(), p, p + n);
+    return true;
+  };
+  if (s.point >= 0) {
+    return inflatePoint(s.point, sink);
+  }
+  s.out.reserve(4 * (s.end - s.begin)); // about what FASTQ compresses to
+  return inflateMembers(s.begin, s.end, sink, false);
+}
+
+bool ParallelGzip::inflateMembers(uint64_t begin, uint64_t end, const Sink& sink, bool lenient) const {
+  z_stream z;
+  memset(&z, 0, sizeof(z));
+  if (inflateInit2(&z, 15 + 16) != Z_OK) {
+    return false;
+  }
+  std::vector<unsigned char> in(chunk);
+  std::vector<char> out(chunk);
+  uint64_t pos = begin;
+  bool complete = false; // the last member inflated has ended
+  bool ok = false;
+  while (true) {
+    if (z.avail_in == 0) {
+      size_t n = (pos < end) ? readAt(fd, in.data(), std::min<uint64_t>(chunk, end - pos), pos) : 0;
+      if (n == 0) {
+        ok = complete;
+        break;
+      }
+      pos += n;
+      z.next_in = in.data();
+      z.avail_in = n;
+    }
+    z.next_out = (Bytef*) out.data();
+    z.avail_out = out.size();
+    int ret = inflate(&z, Z_NO_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END) {
+      ok = lenient && complete; // what follows the last member is not gzip
+      break;
+    }
+    complete = false;
+    size_t produced = out.size() - z.avail_out;
+    if (produced > 0 && !sink(out.data(), produced)) {
+      break;
+    }
+    if (ret == Z_STREAM_END) {
+      complete = true;
+      inflateReset(&z);
+    }
+  }
+  inflateEnd(&z);
+  return ok;
+}
+
+bool ParallelGzip::inflatePoint(int i, const Sink& sink) const {
+  const Point& pt = points[i];
+  uint64_t left = (i + 1 < (int) points.size()) ? points[i+1].out - pt.out : UINT64_MAX;
+
+  z_stream z;
+  memset(&z, 0, sizeof(z));
+  if (inflateInit2(&z, -15) != Z_OK) {
+    return false;
+  }
+  uint64_t pos = pt.in;
+  if (pt.bits > 0) {
+    unsigned char c;
+    if (readAt(fd, &c, 1, pos - 1) != 1) {
+      inflateEnd(&z);
+      return false;
+    }
+    inflatePrime(&z, pt.bits, c >> (8 - pt.bits));
+  }
+  if (pt.window_len > 0) {
+    std::vector<unsigned char> packed(pt.window_clen), window(pt.window_len);
+    uLongf len = window.size();
+    if (readAt(index_fd, packed.data(), packed.size(), pt.window_offset) != packed.size()
+        || uncompress(window.data(), &len, packed.data(), packed.size()) != Z_OK) {
+      inflateEnd(&z);
+      return false;
+    }
+    inflateSetDictionary(&z, window.data(), len);
+  }
+
+  std::vector<unsigned char> in(chunk);
+  std::vector<char> out(chunk);
+  bool raw = true; // until the member the point is in ends
+  size_t skip = 0; // bytes of a gzip trailer still to skip
+  bool complete = false;
+  bool ok = false;
+  while (true) {
+    if (z.avail_in == 0) {
+      size_t n = (pos < size) ? readAt(fd, in.data(), chunk, pos) : 0;
+      if (n == 0) {
+        ok = complete && left == UINT64_MAX; // only the last segment runs to the end
+        break;
+      }
+      pos += n;
+      z.next_in = in.data();
+      z.avail_in = n;
+    }
+    if (skip > 0) {
+      size_t n = std::min<size_t>(skip, z.avail_in);
+      z.next_in += n;
+      z.avail_in -= n;
+      skip -= n;
+      continue;
+    }
+    z.next_out = (Bytef*) out.data();
+    z.avail_out = std::min<uint64_t>(out.size(), left);
+    int ret = inflate(&z, Z_NO_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END) {
+      ok = complete && left == UINT64_MAX;
+      break;
+    }
+    complete = false;
+    size_t produced = z.next_out - (Bytef*) out.data();
+    if (left != UINT64_MAX) {
+      left -= produced;
+    }
+    if (produced > 0) {
+      sink(out.data(), produced);
+    }
+    if (left == 0) {
+      ok = true;
+      break;
+    }
+    if (ret == Z_STREAM_END) {
+      complete = true;
+      if (raw) { // the next member comes with a header and trailer of its own
+        skip = 8;
+        inflateReset2(&z, 15 + 16);
+        raw = false;
+      } else {
+        inflateReset(&z);
+      }
+    }
+  }
+  inflateEnd(&z);
+  return ok;
+}
+
+bool ParallelGzip::write(const char* p, size_t n) {
+  while (n > 0) {
+    ssize_t r = ::write(out_fd, p, n);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return false; // the reading end is closed
+    }
+    p += r;
+    n -= r;
+  }
+  return true;
+}
+
+void ParallelGzip::work() {
+  while (true) {
+    Segment* s;
+    {
+      std::lock_guard<std::mutex> plan(plan_lock);
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        cv.wait(guard, [&]() { return stop || segments.size() < max_segments; });
+        if (stop || planned) {
+          return;
+        }
+      }
+      Segment next;
+      bool more = nextSegment(next);
+      std::lock_guard<std::mutex> guard(lock);
+      if (!more) {
+        planned = true;
+        cv.notify_all();
+        return;
+      }
+      segments.push_back(std::move(next));
+      s = &segments.back(); // stays put, the writer only pops finished ones
+    }
+    bool ok = inflateSegment(*s);
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      s->ok = ok;
+      s->done = true;
+    }
+    cv.notify_all();
+  }
+}
+
+void ParallelGzip::writeOut() {
+  // a closed reading end makes write() fail rather than kill the process
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+  while (true) {
+    Segment s;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      cv.wait(guard, [&]() { return stop || (!segments.empty() && segments.front().done) || (planned && segments.empty()); });
+      if (stop || segments.empty()) {
+        break;
+      }
+      s = std::move(segments.front());
+      segments.pop_front();
+    }
+    cv.notify_all();
+
+    if (!s.ok && s.point >= 0) {
+      std::cerr << "Error: could not inflate " << path << " using " << path << ".kzi" << std::endl;
+      exit(1);
+    }
+    if (!s.ok) {
+      // A header the scan found is not one. This segment starts where the
+      // one before it ended, so inflating from here on is safe.
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+      }
+      cv.notify_all();
+      bool closed = false;
+      if (!inflateMembers(s.begin, size, [&](const char* p, size_t n) { return !(closed = !write(p, n)); }, true) && !closed) {
+        std::cerr << "Error: " << path << " is not a valid gzip file" << std::endl;
+        exit(1);
+      }
+      break;
+    }
+    if (!write(s.out.data(), s.out.size())) {
+      break;
+    }
+  }
+  close(out_fd);
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stop = true;
+  }
+  cv.notify_all();
+}
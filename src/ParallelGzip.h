@@ -0,0 +1,105 @@
+#ifndef KALLISTO_PARALLEL_GZIP_H
+#define KALLISTO_PARALLEL_GZIP_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <zlib.h>
+
+// Inflates a gzip file on several threads and streams the result, in
+// order, through a pipe that gzread reads like any uncompressed file.
+//
+// A gzip file can only be split where inflating can start afresh:
+// - at a member header. BGZF files have one every 64KB, concatenated or
+//   block compressed files now and then. Members are found by scanning
+//   for a header, so a match inside the compressed data is possible; it
+//   shows up as a member that does not end where the next one starts, and
+//   from there on the file is inflated serially.
+// - at an access point of the sidecar index path + ".kzi", which
+//   buildIndex() writes. A file made of a single member needs one.
+class ParallelGzip {
+public:
+  // Opens path for gzread. If threads > 1 and path can be split, inflater
+  // is set to the object inflating it in the background, which is to be
+  // destroyed after the returned file is closed.
+  static gzFile open(const std::string& path, int threads, std::unique_ptr<ParallelGzip>& inflater);
+
+  // Writes the index of path to path + ".kzi", with an access point every
+  // span bytes of uncompressed data.
+  static bool buildIndex(const std::string& path, size_t span = default_span);
+
+  ~ParallelGzip();
+
+  static const size_t default_span = 1ULL<<24;
+  static const size_t segment_size = 1ULL<<20; // compressed bytes per segment between member headers
+
+private:
+  struct Point {
+    uint64_t in; // compressed offset, bits of the byte before it are part of the block
+    uint64_t out; // uncompressed offset
+    int bits;
+    uint32_t window_len; // uncompressed length of the window, the last output before out
+    uint32_t window_clen; // the window is stored compressed, at window_offset in the index
+    uint64_t window_offset;
+  };
+
+  struct Segment {
+    uint64_t begin; // compressed range
+    uint64_t end;
+    int point; // the access point it starts at, or -1 for a member header
+    std::vector<char> out;
+    bool done = false;
+    bool ok = false;
+  };
+
+  typedef std::function<bool(const char*, size_t)> Sink;
+
+  ParallelGzip(const std::string& path, int fd, uint64_t size);
+
+  bool splittable();
+  void start(int out_fd, int threads);
+  bool loadIndex();
+  bool isMember(const unsigned char* p) const;
+  // the first member header in [from, to), or to
+  uint64_t findMember(uint64_t from, uint64_t to) const;
+  bool nextSegment(Segment& s);
+  bool inflateSegment(Segment& s) const;
+  // Inflates the members in [begin, end) into sink; false unless the last
+  // one ends at end. With lenient, whatever follows the last complete
+  // member is ignored, as gzread does.
+  bool inflateMembers(uint64_t begin, uint64_t end, const Sink& sink, bool lenient) const;
+  bool inflatePoint(int i, const Sink& sink) const;
+  bool write(const char* p, size_t n);
+  void work();
+  void writeOut();
+
+  std::string path;
+  int fd;
+  uint64_t size;
+  int out_fd;
+  bool bgzf;
+  int index_fd;
+  std::vector<Point> points;
+
+  std::mutex plan_lock; // held while planning a segment, so segments are planned in order
+  std::mutex lock;
+  std::condition_variable cv;
+  std::deque<Segment> segments; // planned and not yet written, in order
+  size_t max_segments;
+  uint64_t next_begin; // where the next segment starts
+  size_t next_point;
+  bool planned; // all segments have been planned
+  bool stop;
+  std::vector<std::thread> workers;
+  std::thread writer;
+};
+
+#endif // KALLISTO_PARALLEL_GZIP_H
@@ -148,7 +148,10 @@ void plaintext_aux(
     const std::string& index_v,
     const std::string& start_time,
     const std::string& call,
-    const std::string& cardinality_clashes) {
+    const std::string& cardinality_clashes,
+    const std::string& n_em_rounds,
+    const std::string& n_ec_cache_hits,
+    const std::string& n_ec_cache_misses) {
   std::ofstream of;
   of.open( out_name );
 
@@ -185,11 +188,21 @@ void plaintext_aux(
     to_json("kallisto_version", version, true) << std::endl <<
     to_json("index_version", index_v, false) << std::endl <<
     to_json("start_time", start_time, true) << std::endl;
+    // optional entries go last; only the final one is written without a comma
+    std::vector<std::pair<std::string, std::string>> extra;
     if (cardinality_clashes != "") {
-    of << to_json("call", call, true) << std::endl;
-    of <<  to_json("n_frame_clashes", cardinality_clashes, false, false) << std::endl;
-    } else {
-    of << to_json("call", call, true, false) << std::endl;
+      extra.push_back({"n_frame_clashes", cardinality_clashes});
+    }
+    if (n_em_rounds != "") {
+      extra.push_back({"n_em_rounds", n_em_rounds});
+    }
+    if (n_ec_cache_hits != "") {
+      extra.push_back({"n_ec_cache_hits", n_ec_cache_hits});
+      extra.push_back({"n_ec_cache_misses", n_ec_cache_misses});
+    }
+    of << to_json("call", call, true, !extra.empty()) << std::endl;
+    for (size_t i = 0; i < extra.size(); i++) {
+      of << to_json(extra[i].first, extra[i].second, false, i+1 < extra.size()) << std::endl;
     }
     of << "}" << std::endl;
 
@@ -244,7 +257,7 @@ void writeECList(
     // output equivalence classes in the form "EC TXLIST";
     std::vector<Roaring> ecmap(index.ecmapinv.size());
     for (const auto& it : index.ecmapinv) {
-      ecmap[it.second] = it.first;
+      ecmap[it.second] = it.first.ec;
     }
     for (int i = 0 ; i < ecmap.size(); i++) {
       ecof << i << "\t";
@@ -44,7 +44,10 @@ void plaintext_aux(
     const std::string& index_v,
     const std::string& start_time,
     const std::string& call,
-    const std::string& cardinality_clashes="");
+    const std::string& cardinality_clashes="",
+    const std::string& n_em_rounds="",
+    const std::string& n_ec_cache_hits="",
+    const std::string& n_ec_cache_misses="");
 
 void writeBatchMatrix(
   const std::string &prefix,
@@ -11,6 +11,7 @@
 #include "Node.hpp"
 #include <unordered_set>                                                                                                                                                                                     
 #include <algorithm>
+#include <numeric>
 
 void printVector(const std::vector<int>& v, std::ostream& o) {
   o << "[";
@@ -58,47 +59,64 @@ std::pair<const_UnitigMap<Node>, int> findFirstMappingKmer(const std::vector<std
   return std::make_pair(um, p);
 }
 
+// u &= ec, keeping only the targets whose strand in ec agrees with the read
+static void filterStrand(Roaring& u, const SparseVector<uint32_t>& v_ec, bool strand, bool expected) {
+  const Roaring& ec = v_ec.getIndices();
+  SmallEC small, small_ec;
+  if (small.assign(u) && small_ec.assign(ec)) { // no bitmaps needed for short ECs
+    size_t n = small.size();
+    small.intersect(small_ec);
+    small.filter([&](uint32_t tr) {
+      char sense = v_ec[tr];
+      return (strand == (bool)sense) == expected || sense == 2;
+    });
+    if (small.size() < n) {
+      small.toRoaring(u);
+    }
+    return;
+  }
+  Roaring vtmp;
+  u &= ec; // intersection
+  for (auto tr : u) { // strand-specific filtering to produce subset of u: vtmp
+    char sense = v_ec[tr];
+    if ((strand == (bool)sense) == expected || sense == 2) vtmp.add(tr);
+  }
+  if (vtmp.cardinality() < u.cardinality()) u = std::move(vtmp);
+}
+
+// Whether the hits v1 of the first mate leave its pair without a target
+// whatever the second mate holds. The pair maps to the intersection of the
+// two mates, or to nothing when a mate has hits but no target, so this is
+// exact; with --early-exit the second mate is then not matched at all.
+static bool pairRuledOut(const KmerIndex& index, const MinCollector& tc, std::vector<std::pair<const_UnitigMap<Node>, int32_t>>& v1) {
+  if (v1.empty() || index.dfk_onlist) {
+    return false;
+  }
+  Roaring u1 = tc.intersectECs(v1);
+  index.maskOnlist(u1);
+  return u1.isEmpty();
+}
+
 void doStrandSpecificity(Roaring& u, const ProgramOptions::StrandType strand, const std::vector<std::pair<const_UnitigMap<Node>, int32_t> >& v, const std::vector<std::pair<const_UnitigMap<Node>, int32_t> >& v2) {
   int p = -1;
   const_UnitigMap<Node> um;
-  Roaring vtmp;
   if (!v.empty()) {
-    vtmp = Roaring();
     bool firstStrand = (strand == ProgramOptions::StrandType::FR); // FR have first read mapping forward
     auto res = findFirstMappingKmer(v);
     um = res.first;
     p = res.second;
-    // might need to optimize this
     const Node* n = um.getData();
-    auto ecs = n->ec.get_leading_vals(um.dist);
-    const auto& v_ec = ecs[ecs.size() - 1];
-    const Roaring& ec = v_ec.getIndices();
-    
-    u &= ec; // intersection
-    for (auto tr : u) { // strand-specific filtering to produce subset of u: vtmp
-      char sense = v_ec[tr];
-      if ((um.strand == (bool)sense) == firstStrand || sense == 2) vtmp.add(tr);
-    }
-    if (vtmp.cardinality() < u.cardinality()) u = std::move(vtmp);
+    const auto& v_ec = n->ec[um.dist];
+    filterStrand(u, v_ec, um.strand, firstStrand);
   }
   if (!v2.empty()) {
-    vtmp = Roaring();
     bool secondStrand = (strand == ProgramOptions::StrandType::RF);
     auto res = findFirstMappingKmer(v2);
     um = res.first;
     p = res.second;
-    // might need to optimize this
     const Node* n = um.getData();
-    auto ecs = n->ec.get_leading_vals(um.dist);
-    const auto& v_ec = ecs[ecs.size() - 1];
-    const Roaring& ec = v_ec.getIndices();
-    
-    u &= ec; // intersection
-    for (auto tr : u) { // strand-specific filtering to produce subset of u: vtmp
-      char sense = v_ec[tr];
-      if ((um.strand == (bool)sense) == secondStrand || sense == 2) vtmp.add(tr);
-    }
-    if (vtmp.cardinality() < u.cardinality()) u = std::move(vtmp);
+    const auto& v_ec = n->ec[um.dist];
+    filterStrand(u, v_ec, um.strand, secondStrand);
   }
 }
 
@@ -289,12 +307,121 @@ int64_t ProcessBUSReads(MasterProcessor& MP, const  ProgramOptions& opt) {
 }
 
 
+/** -- read batches -- **/
+
+ReadBatch::ReadBatch(size_t bufsize) :
+  buffer(bufsize ? new char[bufsize] : nullptr), bufsize(bufsize), readbatch_id(-1) {
+  seqs.reserve(bufsize/50);
+}
+
+ReadBatch::ReadBatch(ReadBatch&& o) :
+  buffer(o.buffer),
+  bufsize(o.bufsize),
+  seqs(std::move(o.seqs)),
+  names(std::move(o.names)),
+  quals(std::move(o.quals)),
+  flags(std::move(o.flags)),
+  umis(std::move(o.umis)),
+  readbatch_id(o.readbatch_id) {
+    o.buffer = nullptr;
+    o.bufsize = 0;
+}
+
+ReadBatch::~ReadBatch() {
+  delete[] buffer;
+}
+
+void ReadBatch::clear() {
+  seqs.clear();
+  names.clear();
+  quals.clear();
+  flags.clear();
+  umis.clear();
+}
+
+void ReadBatch::swap(ReadBatch& o) {
+  std::swap(buffer, o.buffer);
+  std::swap(bufsize, o.bufsize);
+  seqs.swap(o.seqs);
+  names.swap(o.names);
+  quals.swap(o.quals);
+  flags.swap(o.flags);
+  umis.swap(o.umis);
+  std::swap(readbatch_id, o.readbatch_id);
+}
+
+/** -- read ahead -- **/
+
+ReadAhead::ReadAhead(SequenceReader& SR, size_t bufsize, int n_batches, bool full, bool comments) :
+  SR(SR), full(full), comments(comments), filled(n_batches), empty(n_batches) {
+  batches.reserve(n_batches);
+  for (int i = 0; i < n_batches; i++) {
+    batches.emplace_back(bufsize);
+    empty.push(&batches.back());
+  }
+  reader = std::thread(&ReadAhead::run, this);
+}
+
+ReadAhead::~ReadAhead() {
+  empty.close();
+  reader.join();
+}
+
+void ReadAhead::run() {
+  ReadBatch* b;
+  while (empty.pop(b) && !SR.empty()) {
+    SR.fetchSequences(*b, full, comments);
+    filled.push(b);
+  }
+  filled.close();
+}
+
+bool ReadAhead::next(ReadBatch& batch) {
+  ReadBatch* b;
+  if (!filled.pop(b)) {
+    return false;
+  }
+  batch.swap(*b);
+  empty.push(b);
+  return true;
+}
+
+void ReadAhead::Queue::push(ReadBatch* b) {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    ring[(head + n) % ring.size()] = b;
+    n++;
+  }
+  cv.notify_one();
+}
+
+bool ReadAhead::Queue::pop(ReadBatch*& b) {
+  std::unique_lock<std::mutex> guard(lock);
+  cv.wait(guard, [&]() { return n > 0 || closed; });
+  if (n == 0) {
+    return false;
+  }
+  b = ring[head];
+  head = (head + 1) % ring.size();
+  n--;
+  return true;
+}
+
+void ReadAhead::Queue::close() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    closed = true;
+  }
+  cv.notify_all();
+}
+
 /** -- read processors -- **/
 
 void MasterProcessor::processReads() {
   // start worker threads
   if (!opt.batch_mode && !opt.bus_mode) {
 
+    read_ahead.reset(new ReadAhead(*SR, bufsize, read_ahead_batches, opt.pseudobam || opt.fusion, false));
     std::vector<std::thread> workers;
     for (int i = 0; i < opt.threads; i++) {
       workers.emplace_back(std::thread(ReadProcessor(index,opt,tc,*this,-1,i)));
@@ -306,20 +433,10 @@ void MasterProcessor::processReads() {
       workers[i].join(); //wait for them to finish
       std::cerr << "isn't reaching here? Joining threads i = " << i << std::endl; std::cerr.flush(); 
     }
+    read_ahead.reset();
 
     // now handle the modification of the mincollector
-    for (auto &t : newECcount) {
-
-      if (t.second <= 0) {
-        continue;
-      }
-
-      int ec = tc.increaseCount(t.first); // modifies the ecmap
-
-      if (ec != -1 && t.second > 1) {
-        tc.counts[ec] += (t.second-1);
-      }
-    }
+    transferECs();
   } else if (opt.bus_mode) {
     std::vector<std::thread> workers;
     parallel_bus_read = opt.threads > 4 && opt.files.size() > opt.busOptions.nfiles && !opt.num && !opt.pseudobam && opt.input_interleaved_nfiles == 0;
@@ -335,10 +452,15 @@ void MasterProcessor::processReads() {
         fSR.files.erase(fSR.files.begin(), fSR.files.begin()+opt.busOptions.nfiles*i);
         fSR.files.erase(fSR.files.begin()+opt.busOptions.nfiles, fSR.files.end());
         assert(fSR.files.size() == opt.busOptions.nfiles);
+        // every batch can be open at once, so they split the threads too
+        fSR.threads = std::max(1, opt.threads / (int) opt.files.size());
         FSRs.push_back(std::move(fSR));
         std::cerr << "processReads() batch = " << i << std::endl; std::cerr.flush();
       }
     }
+    if (SR != nullptr) {
+      read_ahead.reset(new ReadAhead(*SR, bufsize, read_ahead_batches, opt.pseudobam || opt.fusion, opt.busOptions.keep_fastq_comments));
+    }
 
     for (int i = 0; i < opt.threads; i++) {
       workers.emplace_back(std::thread(BUSProcessor(index,opt,tc,*this,-1,i)));
@@ -350,14 +472,10 @@ void MasterProcessor::processReads() {
       workers[i].join(); //wait for them to finish
       std::cerr << "isn't reaching here? Joining threads i = " << i << std::endl; std::cerr.flush(); 
     }
+    read_ahead.reset();
 
     // now handle the modification of the mincollector
-    for (auto &x : bus_ecmapinv) {
-      auto &u = x.first;
-      int ec = x.second;
-      index.ecmapinv.insert({u,ec});
-    }
-    tc.counts.resize(index.ecmapinv.size(), 0);
+    transferECs();
     std::cerr << "Does it reach the end of bus if option ??? " << std::endl; std::cerr.flush();  
 
   } else if (opt.batch_mode) {
@@ -402,12 +520,7 @@ void MasterProcessor::processReads() {
 
     // now handle the modification of the mincollector
     std::cerr << "processReads() updating min collector " << std::endl; std::cerr.flush();
-    for (auto &x : bus_ecmapinv) {
-      auto &u = x.first;
-      int ec = x.second;
-      index.ecmapinv.insert({u,ec});
-    }
-    tc.counts.resize(index.ecmapinv.size(), 0);
+    transferECs();
     std::cerr << "processReads() finished updating min collector " << std::endl; std::cerr.flush();
   }
 
@@ -419,68 +532,57 @@ void MasterProcessor::processReads() {
   }
 }
 
-void MasterProcessor::update(const std::vector<uint32_t>& c, const std::vector<Roaring> &newEcs,
+// Moves the ECs discovered while processing reads into index.ecmapinv.
+// The BUS output already refers to ECs by the ids the shared map handed
+// out, so those are kept as is. In quant mode nothing has seen the ids
+// yet, and the new ECs are renumbered by their transcript lists so that
+// EC order (and with it the EM's summation order) does not depend on
+// which thread saw an EC first. The inserts can move the keys ecmap
+// adopted from index.ecmapinv, so ecmap is done with after this.
+void MasterProcessor::transferECs() {
+  auto ecs = ecmap.ecs();
+  const size_t base = index.ecmapinv.size();
+  std::vector<int32_t> order(ecs.size()-base);
+  std::iota(order.begin(), order.end(), (int32_t) base);
+  tc.counts.resize(ecs.size(), 0);
+
+  if (!opt.bus_mode && !opt.batch_mode) {
+    std::vector<std::vector<uint32_t>> trs(order.size());
+    for (size_t i = 0; i < order.size(); i++) {
+      const Roaring& u = ecs[base+i]->ec;
+      trs[i].resize(u.cardinality());
+      u.toUint32Array(trs[i].data());
+    }
+    std::sort(order.begin(), order.end(), [&](int32_t a, int32_t b) {
+      return trs[a-base] < trs[b-base];
+    });
+    std::vector<uint32_t> counts(tc.counts.begin(), tc.counts.begin()+base);
+    for (auto ec : order) {
+      counts.push_back(tc.counts[ec]);
+    }
+    tc.counts.swap(counts);
+  }
+
+  for (size_t i = 0; i < order.size(); i++) {
+    index.ecmapinv.insert({*ecs[order[i]], (int32_t) (base+i)});
+  }
+}
+
+void MasterProcessor::update(const ECCountDelta& c,
                             std::vector<std::pair<Roaring, std::string>>& ec_umi, std::vector<std::pair<Roaring, std::string>> &new_ec_umi,
                             int n, std::vector<int>& flens, std::vector<int>& flens_lr, std::vector<int>& flens_lr_c, std::vector<int> &bias, 
-														 const PseudoAlignmentBatch& pseudobatch, std::vector<BUSData> &bv, std::vector<std::pair<BUSData, Roaring>> newBP, 
+														 const PseudoAlignmentBatch& pseudobatch, std::vector<BUSData> &bv,
 														 int *bc_len, int *umi_len,  int id, int local_id) {
   // acquire the writer lock
   std::lock_guard<std::mutex> lock(this->writer_lock);
-  size_t num_new_ecs = 0;
-
-  for (int i = 0; i < c.size(); i++) {
-    tc.counts[i] += c[i]; // add up ec counts
-    nummapped += c[i];
-  }
-
-  auto attempt_transfer_ecs = [&](size_t num_new_ecs_) {
-    if (num_new_ecs_ >= transfer_threshold) {
-      std::vector<std::unique_lock<std::mutex>> locks;
-      for (int i = 0; i < this->transfer_locks.size(); i++) { // acquire one lock per thread
-        locks.push_back(std::unique_lock<std::mutex>(this->transfer_locks[i]));
-      }
-      size_t num_new_ecs_actual = 0;
-      int curr_max_ec = index.ecmapinv.size()-1;
-      if (opt.bus_mode || opt.batch_mode) {
-        num_new_ecs_actual = bus_ecmapinv.size()-(curr_max_ec+1);
-        if (num_new_ecs_actual >= transfer_threshold) {
-          for (auto &x : bus_ecmapinv) {
-            index.ecmapinv.insert({x.first,x.second});
-          }
-        }
-      } else {
-        for (auto &t : newECcount) {
-          if (t.second <= 0) {
-            continue;
-          }
-          int ec = tc.increaseCount(t.first); // modifies the ecmap
-          if (ec != -1 && t.second > 1) {
-            tc.counts[ec] += (t.second-1);
-          }
-          if (ec > curr_max_ec) {
-            num_new_ecs_actual++;
-          }
-        }
-        newECcount.clear();
-      }
-      if (num_new_ecs_actual >= transfer_threshold) {
-        if (transfer_threshold <= 4) {
-          transfer_threshold++;
-        } else {
-          transfer_threshold *= 1.25;
-        }
-      }
-      for (int i = 0; i < this->transfer_locks.size(); i++) { // release each lock
-        locks[i].unlock();
-      }
-    }
-  };
 
-  for(auto &u : newEcs) {
-    ++newECcount[u];
+  if (!c.ecs.empty() && tc.counts.size() < c.dense.size()) {
+    tc.counts.resize(c.dense.size(), 0); // ECs discovered since the last batch
+  }
+  for (auto ec : c.ecs) {
+    tc.counts[ec] += c.dense[ec]; // add up ec counts
+    nummapped += c.dense[ec];
   }
-  nummapped += newEcs.size();
-  num_new_ecs = newECcount.size();
 
   if (!flens.empty()) {
     if (opt.batch_mode) {
@@ -569,48 +671,25 @@ void MasterProcessor::update(const std::vector<uint32_t>& c, const std::vector<R
     }
     
     if (opt.max_num_reads != 0 && numreads+n > opt.max_num_reads) { // Downsample current batch of reads while maintaining ratio of unmapped/mapped reads
-      int bv_size = bv.size();
-      int newBP_size = newBP.size(); // We'll also try to maintain the ratio of bv to newBP records
-      int n_mapped = bv_size+newBP_size;
+      int n_mapped = bv.size();
       int new_n = opt.max_num_reads-numreads;
       int new_mapped_num = ((double)n_mapped/(double)n)*new_n;
-      int new_mapped_bv_num = ((double)bv_size/(double)n_mapped)*new_mapped_num;
-      int new_mapped_newBP_num = new_mapped_num - new_mapped_bv_num;
       n = new_n;
       
-      if (new_mapped_bv_num < bv_size) bv.resize(new_mapped_bv_num);
-      if (new_mapped_newBP_num < newBP_size) newBP.resize(new_mapped_newBP_num);
-    }
-
-    // add new equiv classes to extra format
-    int offset = 0; // index.ecmapinv.size();
-    num_new_ecs = 0;
-    for (auto &bp : newBP) {
-      auto& u = bp.second;
-      int32_t ec = -1;
-      auto it = bus_ecmapinv.find(u);
-      if (it != bus_ecmapinv.end()) {
-        ec = it->second;
-      } else {
-        ec = offset + bus_ecmapinv.size();
-        bus_ecmapinv.insert({u,ec});
-        tc.counts.push_back(0); // Push back zero count (so we can update the EC's actual count later)
-        num_new_ecs++;
+      if (new_mapped_num < n_mapped) bv.resize(new_mapped_num);
+    }
+
+    // make room for the counts of ECs discovered since the last batch
+    for (const auto &b : bv) {
+      if (b.ec >= (int32_t) tc.counts.size()) {
+        tc.counts.resize(b.ec+1, 0);
       }
-      auto &b = bp.first;
-      b.ec = ec;
-      bv.push_back(b);
     }
 
     //copy bus mode information, write to disk or queue up
     nummapped += writeBUSData(busf_out, bv, &tc);
-    /*for (auto &bp : newBP) {
-      newB.push_back(std::move(bp));
-    } */
   }
 
-  attempt_transfer_ecs(num_new_ecs);
-
   numreads += n;
   
   //if (opt.verbose) {
@@ -869,11 +948,7 @@ void MasterProcessor::outputFusion(const std::stringstream &o) {
 
 
 ReadProcessor::ReadProcessor(const KmerIndex& index, const ProgramOptions& opt, const MinCollector& tc, MasterProcessor& mp, int _id, int _local_id) :
- paired(!opt.single_end && !opt.long_read), tc(tc), index(index), mp(mp), id(_id), local_id(_local_id) {
-   // initialize buffer
-   bufsize = mp.bufsize;
-   buffer = new char[bufsize];
-
+ batch(mp.bufsize), paired(!opt.single_end && !opt.long_read), tc(tc), index(index), mp(mp), id(_id), local_id(_local_id), ec_cache(opt.ec_cache_size), ec_cache_has_mean_fl(tc.has_mean_fl) {
    if (opt.batch_mode) {
      assert(id != -1);
      batchSR.files = opt.batch_files[id];
@@ -882,75 +957,53 @@ ReadProcessor::ReadProcessor(const KmerIndex& index, const ProgramOptions& opt,
      batchSR.paired = !opt.single_end && !opt.long_read;
    }
 
-   seqs.reserve(bufsize/50);
-   newEcs.reserve(1000);
-   counts.reserve((int) (tc.counts.size() * 1.25));
+   counts.dense.reserve((int) (tc.counts.size() * 1.25));
    clear();
 }
 
 ReadProcessor::ReadProcessor(ReadProcessor && o) :
+  batch(std::move(o.batch)),
   paired(o.paired),
   tc(o.tc),
   index(o.index),
   mp(o.mp),
+  batchSR(std::move(o.batchSR)),
+  numreads(o.numreads),
   id(o.id),
   local_id(o.local_id),
-  bufsize(o.bufsize),
-  numreads(o.numreads),
-  seqs(std::move(o.seqs)),
-  names(std::move(o.names)),
-  quals(std::move(o.quals)),
-  flags(std::move(o.flags)),
-  umis(std::move(o.umis)),
-  newEcs(std::move(o.newEcs)),
   flens(std::move(o.flens)),
   flens_lr(std::move(o.flens_lr)),
   flens_lr_c(std::move(o.flens_lr_c)),
   bias5(std::move(o.bias5)),
-  batchSR(std::move(o.batchSR)),
-  counts(std::move(o.counts)) {
-    buffer = o.buffer;
-    o.buffer = nullptr;
-    o.bufsize = 0;
-}
-
-ReadProcessor::~ReadProcessor() {
-  if (buffer != nullptr) {
-      delete[] buffer;
-      buffer = nullptr;
-  }
+  counts(std::move(o.counts)),
+  ec_cache(std::move(o.ec_cache)),
+  ec_cache_has_mean_fl(o.ec_cache_has_mean_fl) {
 }
 
 void ReadProcessor::operator()() {
   while (true) {
-    int readbatch_id;
     // grab the reader lock
     if (mp.opt.batch_mode) {
       if (batchSR.empty()) {
         return;
       } else {
-        batchSR.fetchSequences(buffer, bufsize, seqs, names, quals, flags, umis, readbatch_id, mp.opt.pseudobam );
+        batchSR.fetchSequences(batch, mp.opt.pseudobam);
       }
-    } else {
-      std::lock_guard<std::mutex> lock(mp.reader_lock);
-      if (mp.SR->empty()) {
-        // nothing to do
-        return;
-      } else {
-        // get new sequences
-        mp.SR->fetchSequences(buffer, bufsize, seqs, names, quals, flags, umis, readbatch_id, mp.opt.pseudobam || mp.opt.fusion);
-      }
-
-      // release the reader lock
+    } else if (!mp.read_ahead->next(batch)) {
+      // nothing to do
+      return;
     }
     pseudobatch.aln.clear();
-    pseudobatch.batch_id = readbatch_id;
+    pseudobatch.batch_id = batch.readbatch_id;
     // process our sequences
     processBuffer();
 
     // update the results, MP acquires the lock
     std::vector<BUSData> tmp_v{};
-    mp.update(counts, newEcs, ec_umi, new_ec_umi, paired ? seqs.size()/2 : seqs.size(), flens, flens_lr, flens_lr_c, bias5, pseudobatch, tmp_v, std::vector<std::pair<BUSData, Roaring>>{}, nullptr, nullptr, id, local_id);
+    mp.update(counts, ec_umi, new_ec_umi, paired ? batch.seqs.size()/2 : batch.seqs.size(), flens, flens_lr, flens_lr_c, bias5, pseudobatch, tmp_v, nullptr, nullptr, id, local_id);
+    mp.ec_cache_hits += ec_cache.hits;
+    mp.ec_cache_misses += ec_cache.misses;
+    ec_cache.hits = ec_cache.misses = 0;
     clear();
   }
 }
@@ -959,6 +1012,7 @@ void ReadProcessor::processBuffer() {
   // set up thread variables
   std::vector<std::pair<const_UnitigMap<Node>, int32_t> > v1, v2, vlr;
   Roaring u, lr, vtmp;
+  std::vector<std::pair<int,bool>> positions; // of the read in each target of u
 
   if (mp.opt.long_read){
     v1.reserve(10000);
@@ -1025,32 +1079,51 @@ void ReadProcessor::processBuffer() {
     }
   }
 
+  // Once no fragment length, bias or alignment information is collected
+  // from a read, its EC only depends on its sequence (the overhang filter
+  // is fixed while tc.has_mean_fl is), so duplicates can be served from
+  // ec_cache, unless --ec-cache-size=0 turned it off.
+  const bool use_ec_cache = ec_cache.capacity() > 0 && !findFragmentLength && !findBias && !mp.opt.pseudobam && !mp.opt.fusion && !mp.opt.long_read;
+  if (ec_cache_has_mean_fl != tc.has_mean_fl) {
+    ec_cache.clear();
+    ec_cache_has_mean_fl = tc.has_mean_fl;
+  }
+
   // actually process the sequences
-  for (int i = 0; i < seqs.size(); i++) {
+  for (int i = 0; i < batch.seqs.size(); i++) {
 
-    s1 = seqs[i].first;
-    l1 = seqs[i].second;
+    s1 = batch.seqs[i].first;
+    l1 = batch.seqs[i].second;
     if (paired) {
       i++;
-      s2 = seqs[i].first;
-      l2 = seqs[i].second;
+      s2 = batch.seqs[i].first;
+      l2 = batch.seqs[i].second;
     }
 
     numreads++;
+
+    int32_t ec;
+    if (use_ec_cache && ec_cache.find(s1, l1, paired ? s2 : nullptr, l2, 0, ec)) {
+      if (ec >= 0) {
+        counts.add(ec);
+      }
+      continue;
+    }
+
     v1.clear();
     v2.clear();
     u = Roaring();
 
     // process read
     index.match(s1, l1, v1, !paired);
-    if (paired) {
+    if (paired && !(mp.opt.early_exit && pairRuledOut(index, tc, v1))) {
       index.match(s2, l2, v2, !paired);
     }
 
     // collect the target information
     int r = tc.intersectKmers(v1, v2, !paired, u);
     // Mask out off-listed kmers
-    u &= index.onlist_sequences;
+    index.maskOnlist(u);
 
     if (u.isEmpty()) {
       if (mp.opt.fusion && !(v1.empty() || v2.empty())) {
@@ -1190,9 +1263,11 @@ void ReadProcessor::processBuffer() {
       }
 
       // for each transcript in the pseudoalignment
+      index.findPositions(u, km, um, p, positions);
+      size_t i = 0;
       for (auto tr : u) {
 
-        auto x = index.findPosition(tr, km, um, p);
+        auto x = positions[i++];
         // if the fragment is within bounds for this transcript, keep it
         if (x.second && x.first + fl <= (int)index.target_lens_[tr]) {
 	  //if (!mp.opt.long_read || (mp.opt.long_read && x.first < 5)){
@@ -1220,20 +1295,11 @@ void ReadProcessor::processBuffer() {
     }
 
     // find the ec
+    ec = -1;
     if (!u.isEmpty()) { //&& (!mp.opt.long_read || (mp.opt.long_read && u.cardinality() == 1))) { //THIS IS FOR ONLY UNIQUELY ALIGNING LONG READS 
-      std::lock_guard<std::mutex> lock(mp.transfer_locks[local_id]);
-
-      // count the pseudoalignment
-      auto elem = index.ecmapinv.find(u);
-      if (elem == index.ecmapinv.end()) {
-        // something we haven't seen before
-        newEcs.push_back(u);
-      } else if (elem->second >= counts.size()) { // handle race condition (if counts isn't updated yet)
-        newEcs.push_back(u);
-      } else {
-        // add to count vector
-        ++counts[elem->second];
-      }
+      // count the pseudoalignment, registering the ec if we haven't seen it before
+      ec = mp.ecmap.insert(u);
+      counts.add(ec);
 
       /* -- collect extra information -- */
       // collect bias info
@@ -1247,8 +1313,8 @@ void ReadProcessor::processBuffer() {
 
       // collect fragment length info
       if (findFragmentLength && flengoal > 0 && paired && u.cardinality() == 1 && !v1.empty() && !v2.empty()) {
-        // try to map the reads
-        int tl = index.mapPair(s1, l1, s2, l2);
+        // try to map the reads, from the k-mers match() found
+        int tl = index.mapPair(v1, v2);
         if (0 < tl && tl < flens.size()) {
           flens[tl]++;
           flengoal--;
@@ -1265,6 +1331,10 @@ void ReadProcessor::processBuffer() {
       }
     }
 
+    if (use_ec_cache) {
+      ec_cache.insert(ec);
+    }
+
     // pseudobam
 
     if (mp.opt.pseudobam) {
@@ -1295,10 +1365,7 @@ void ReadProcessor::processBuffer() {
 
 void ReadProcessor::clear() {
   numreads=0;
-  memset(buffer,0,bufsize);
-  newEcs.clear();
   counts.clear();
-  counts.resize(tc.counts.size(),0);
   ec_umi.clear();
   new_ec_umi.clear();
 }
@@ -1306,14 +1373,8 @@ void ReadProcessor::clear() {
 
 
 BUSProcessor::BUSProcessor(/*const*/ KmerIndex& index, const ProgramOptions& opt, const MinCollector& tc, MasterProcessor& mp, int _id, int _local_id) :
- paired(!opt.single_end && !opt.long_read), bam(opt.bam), num(opt.num), tc(tc), index(index), mp(mp), id(_id), local_id(_local_id), numreads(0) {
-   // initialize buffer
-   bufsize = mp.bufsize;
-   buffer = new char[bufsize];
-   seqs.reserve(bufsize/50);
-   newEcs.reserve(1000);
+ batch(mp.bufsize), paired(!opt.single_end && !opt.long_read), bam(opt.bam), num(opt.num), tc(tc), index(index), mp(mp), id(_id), local_id(_local_id), numreads(0), ec_cache(opt.ec_cache_size) {
    bv.reserve(1000);
-   counts.reserve((int) (tc.counts.size() * 1.25));
    memset(&bc_len[0],0,sizeof(bc_len));
    memset(&umi_len[0],0,sizeof(umi_len));
 
@@ -1321,41 +1382,26 @@ BUSProcessor::BUSProcessor(/*const*/ KmerIndex& index, const ProgramOptions& opt
 }
 
 BUSProcessor::BUSProcessor(BUSProcessor && o) :
+  batch(std::move(o.batch)),
   paired(o.paired),
   bam(o.bam),
   num(o.num),
   tc(o.tc),
   index(o.index),
   mp(o.mp),
+  numreads(o.numreads),
   id(o.id),
   local_id(o.local_id),
-  bufsize(o.bufsize),
-  numreads(o.numreads),
-  seqs(std::move(o.seqs)),
-  names(std::move(o.names)),
-  quals(std::move(o.quals)),
-  flags(std::move(o.flags)),
-  newEcs(std::move(o.newEcs)),
+  batchSR(std::move(o.batchSR)),
   flens(std::move(o.flens)),
   flens_lr(std::move(o.flens_lr)),
   flens_lr_c(std::move(o.flens_lr_c)),
   bias5(std::move(o.bias5)),
-  bv(std::move(o.bv)),
-  batchSR(std::move(o.batchSR)),
   counts(std::move(o.counts)),
-  umis(std::move(o.umis)) {
+  bv(std::move(o.bv)),
+  ec_cache(std::move(o.ec_cache)) {
     memcpy(&bc_len[0], &o.bc_len[0], sizeof(bc_len));
     memcpy(&umi_len[0], &o.umi_len[0], sizeof(umi_len));
-    buffer = o.buffer;
-    o.buffer = nullptr;
-    o.bufsize = 0;
-}
-
-BUSProcessor::~BUSProcessor() {
-  if (buffer != nullptr) {
-      delete[] buffer;
-      buffer = nullptr;
-  }
 }
 
 void BUSProcessor::operator()() {
@@ -1363,7 +1409,6 @@ void BUSProcessor::operator()() {
   int initial_id = id;
   std::unordered_set<int> parallel_bus_read_empty;
   while (true) {
-    int readbatch_id;
     // grab the reader lock
     if (mp.opt.batch_mode) {
       int num_ids = mp.opt.batch_ids.size();
@@ -1386,7 +1431,7 @@ void BUSProcessor::operator()() {
         }
         continue;
       } else {
-        mp.FSRs[SRindex].fetchSequences(buffer, bufsize, seqs, names, quals, flags, umis, readbatch_id, mp.opt.pseudobam, mp.opt.busOptions.keep_fastq_comments);
+        mp.FSRs[SRindex].fetchSequences(batch, mp.opt.pseudobam, mp.opt.busOptions.keep_fastq_comments);
       }
     } else if (mp.opt.bus_mode && mp.parallel_bus_read) {
       int nbatches = mp.opt.files.size() / mp.opt.busOptions.nfiles;
@@ -1400,28 +1445,24 @@ void BUSProcessor::operator()() {
         parallel_bus_read_empty.emplace(i);
         continue;
       }
-      mp.FSRs[i].fetchSequences(buffer, bufsize, seqs, names, quals, flags, umis, readbatch_id, mp.opt.pseudobam || mp.opt.fusion, mp.opt.busOptions.keep_fastq_comments);
-    } else {
-      std::lock_guard<std::mutex> lock(mp.reader_lock);
-      if (mp.SR->empty()) {
-        // nothing to do
-        return;
-      } else {
-        // get new sequences
-        mp.SR->fetchSequences(buffer, bufsize, seqs, names, quals, flags, umis, readbatch_id, mp.opt.pseudobam || mp.opt.fusion, mp.opt.busOptions.keep_fastq_comments);
-      }
-      // release the reader lock
+      mp.FSRs[i].fetchSequences(batch, mp.opt.pseudobam || mp.opt.fusion, mp.opt.busOptions.keep_fastq_comments);
+    } else if (!mp.read_ahead->next(batch)) {
+      // nothing to do
+      return;
     }
 
     pseudobatch.aln.clear();
-    pseudobatch.batch_id = readbatch_id;
+    pseudobatch.batch_id = batch.readbatch_id;
     // process our sequences
     processBuffer();
 
     // update the results, MP acquires the lock
     std::vector<std::pair<Roaring, std::string>> ec_umi;
     std::vector<std::pair<Roaring, std::string>> new_ec_umi;
-    mp.update(counts, newEcs, ec_umi, new_ec_umi, seqs.size() / mp.opt.busOptions.nfiles , flens, flens_lr, flens_lr_c, bias5, pseudobatch, bv, std::move(newB), &bc_len[0], &umi_len[0], id, local_id);
+    mp.update(counts, ec_umi, new_ec_umi, batch.seqs.size() / mp.opt.busOptions.nfiles , flens, flens_lr, flens_lr_c, bias5, pseudobatch, bv, &bc_len[0], &umi_len[0], id, local_id);
+    mp.ec_cache_hits += ec_cache.hits;
+    mp.ec_cache_misses += ec_cache.misses;
+    ec_cache.hits = ec_cache.misses = 0;
     clear();
     if (mp.opt.max_num_reads != 0 && mp.numreads >= mp.opt.max_num_reads) {
       return;
@@ -1522,11 +1563,16 @@ void BUSProcessor::processBuffer() {
     tag_binary = stringToBinary(mp.opt.tagsequence, f);
   }
 
+  // as in ReadProcessor::processBuffer, duplicates can be served from
+  // ec_cache once nothing but the EC is taken from a read; the strand
+  // filter is switched per read, so it is part of the key
+  const bool use_ec_cache = ec_cache.capacity() > 0 && !(findFragmentLength && busopt.paired) && !busopt.long_read && !busopt.aa && !mp.opt.pseudobam;
+
   //int incf = (bam) ? 1 : busopt.nfiles-1;
-  for (int i = 0; i + incf < seqs.size(); i++) {
+  for (int i = 0; i + incf < batch.seqs.size(); i++) {
     for (int j = 0; j < jmax /*(bam) ? 2 : busopt.nfiles*/; j++) {
-      s[j] = seqs[i+j].first;
-      l[j] = seqs[i+j].second;
+      s[j] = batch.seqs[i+j].first;
+      l[j] = batch.seqs[i+j].second;
     }
     i += incf;
 
@@ -1548,10 +1594,10 @@ void BUSProcessor::processBuffer() {
       ignore_umi = true;
       getFragLenIfPaired = true;
     } else if (busopt.keep_fastq_comments) { // UMI is in SAM tag (RX:Z:)
-      if (umis[i].length() > 0) {
+      if (batch.umis[i].second > 0) {
         // Take the UMI from the first read in the set (i.e. j=0)
-        ulen = umis[i].length() > 32 ? 32 : umis[i].length();
-        memcpy(umi, umis[i].c_str(), ulen);
+        ulen = batch.umis[i].second > 32 ? 32 : batch.umis[i].second;
+        memcpy(umi, batch.umis[i].first, ulen);
         umi[ulen] = 0;
       } else {
         bad_umi = true;
@@ -1686,86 +1732,94 @@ void BUSProcessor::processBuffer() {
     v.clear();
     u = Roaring();
     
-    bool match_partial = !busopt.paired && !index.dfk_onlist;
-
-    index.match(seq, seqlen, v, match_partial, busopt.aa);
-
-    // process 2nd read
-    if (busopt.paired) {
-      v2.clear();
-      index.match(seq2, seqlen2, v2, match_partial);
-    }
-
-    // process frames for commafree (to do: extend to paired-end reads)
-    if (busopt.aa) {
-      // initiate equivalence classes
-      std::vector<std::pair<const_UnitigMap<Node>, int>> v3, v4, v5, v6, v7;
-      v3.reserve(1000);
-      v4.reserve(1000);
-      v5.reserve(1000);
-      v6.reserve(1000);
-      v7.reserve(1000);
-
-      // align remaining forward frames using the match function
-      const char * seq3 = seq+1;
-      size_t seqlen3 = strlen(seq3);
-      v3.clear();
-      index.match(seq3, seqlen3, v3, match_partial, busopt.aa);
-
-      const char * seq4 = seq+2;
-      size_t seqlen4 = strlen(seq4);
-      v4.clear();
-      index.match(seq4, seqlen4, v4, match_partial, busopt.aa);
-
-      // get reverse complement of seq
-      // const char * to string
-      std::string com_seq(seq);
-      // transform comseq to its reverse complement
-      com_seq = revcomp (std::move(com_seq));
-      // string to const char *
-      const char * com_seq_char = com_seq.c_str();
-
-      // align reverse complement frames using the match function
-      size_t seqlen5 = strlen(com_seq_char);
-      v5.clear();
-      index.match(com_seq_char, seqlen5, v5, match_partial, busopt.aa);
-
-      const char * seq6 = com_seq_char+1;
-      size_t seqlen6 = strlen(seq6);
-      v6.clear();
-      index.match(seq6, seqlen6, v6, match_partial, busopt.aa);
-
-      const char * seq7 = com_seq_char+2;
-      size_t seqlen7 = strlen(seq7);
-      v7.clear();
-      index.match(seq7, seqlen7, v7, match_partial, busopt.aa);
-
-      // intersect set of equivalence classes for each frame
-      // NOTE: intersectKmers is called again further up. to-do: Do I need to modify that too?
-      int r = tc.intersectKmersCFC(v, v3, v4, v5, v6, v7, u);
-    }
-    else {
-      // collect the target information
-      int r = tc.intersectKmers(v, v2, !busopt.paired, u);
-    }
-    
-    if (!u.isEmpty()) {
-      if (index.dfk_onlist) { // In case we want to not intersect D-list targets
-        auto usize = u.cardinality();
-        u &= index.onlist_sequences;
-        if (u.cardinality() != usize && !(usize > 0 && u.cardinality() == 0)) {
-          // Add if a D-list elem exists but not if ALL elems are D-listed
-          u.add(index.onlist_sequences.cardinality());
+    int32_t ec = -1;
+    if (!(use_ec_cache && ec_cache.find(seq, seqlen, busopt.paired ? seq2 : nullptr, seqlen2, doStrandSpecificityIfPossible, ec))) {
+      bool match_partial = !busopt.paired && !index.dfk_onlist;
+
+      index.match(seq, seqlen, v, match_partial, busopt.aa);
+
+      // process 2nd read
+      if (busopt.paired) {
+        v2.clear();
+        if (!(mp.opt.early_exit && pairRuledOut(index, tc, v))) {
+          index.match(seq2, seqlen2, v2, match_partial);
+        }
+      }
+
+      // process frames for commafree (to do: extend to paired-end reads)
+      if (busopt.aa) {
+        // initiate equivalence classes
+        std::vector<std::pair<const_UnitigMap<Node>, int>> v3, v4, v5, v6, v7;
+        v3.reserve(1000);
+        v4.reserve(1000);
+        v5.reserve(1000);
+        v6.reserve(1000);
+        v7.reserve(1000);
+
+        // align remaining forward frames using the match function
+        const char * seq3 = seq+1;
+        size_t seqlen3 = strlen(seq3);
+        v3.clear();
+        index.match(seq3, seqlen3, v3, match_partial, busopt.aa);
+
+        const char * seq4 = seq+2;
+        size_t seqlen4 = strlen(seq4);
+        v4.clear();
+        index.match(seq4, seqlen4, v4, match_partial, busopt.aa);
+
+        // get reverse complement of seq
+        // const char * to string
+        std::string com_seq(seq);
+        // transform comseq to its reverse complement
+        com_seq = revcomp (std::move(com_seq));
+        // string to const char *
+        const char * com_seq_char = com_seq.c_str();
+
+        // align reverse complement frames using the match function
+        size_t seqlen5 = strlen(com_seq_char);
+        v5.clear();
+        index.match(com_seq_char, seqlen5, v5, match_partial, busopt.aa);
+
+        const char * seq6 = com_seq_char+1;
+        size_t seqlen6 = strlen(seq6);
+        v6.clear();
+        index.match(seq6, seqlen6, v6, match_partial, busopt.aa);
+
+        const char * seq7 = com_seq_char+2;
+        size_t seqlen7 = strlen(seq7);
+        v7.clear();
+        index.match(seq7, seqlen7, v7, match_partial, busopt.aa);
+
+        // intersect set of equivalence classes for each frame
+        // NOTE: intersectKmers is called again further up. to-do: Do I need to modify that too?
+        int r = tc.intersectKmersCFC(v, v3, v4, v5, v6, v7, u);
+      }
+      else {
+        // collect the target information
+        int r = tc.intersectKmers(v, v2, !busopt.paired, u);
+      }
+
+      if (!u.isEmpty()) {
+        if (index.dfk_onlist) { // In case we want to not intersect D-list targets
+          if (index.maskOnlist(u) && !u.isEmpty()) {
+            // Add if a D-list elem exists but not if ALL elems are D-listed
+            u.add(index.onlist_sequences.cardinality());
+          }
+        } else { // Normal/standard workflow:
+          // Mask out off-listed kmers
+          index.maskOnlist(u);
         }
-      } else { // Normal/standard workflow:
-        // Mask out off-listed kmers
-        u &= index.onlist_sequences;
       }
-    }
 
-    if (doStrandSpecificityIfPossible && mp.opt.strand_specific && !u.isEmpty()) { // Strand-specificity
-      doStrandSpecificity(u, mp.opt.strand, v, v2);
-    } 
+      if (doStrandSpecificityIfPossible && mp.opt.strand_specific && !u.isEmpty()) { // Strand-specificity
+        doStrandSpecificity(u, mp.opt.strand, v, v2);
+      } 
+
+      ec = u.isEmpty() ? -1 : mp.ecmap.insert(u);
+      if (use_ec_cache) {
+        ec_cache.insert(ec);
+      }
+    }
 
     /***
     if (busopt.long_read && !u.isEmpty()) {
@@ -1807,7 +1861,7 @@ void BUSProcessor::processBuffer() {
   ***/
 
     // find the ec
-    if (!u.isEmpty()) {// for each transcript in the pseudoalignment
+    if (ec >= 0) {// for each transcript in the pseudoalignment
 	    
       BUSData b;
       uint32_t f = 0;
@@ -1819,13 +1873,14 @@ void BUSProcessor::processBuffer() {
       b.count = 1;
       //std::cout << std::string(s1,10)  << "\t" << b.barcode << "\t" << std::string(s1+10,16) << "\t" << b.UMI << "\n";
       if (num) {
-        b.flags = (uint32_t) flags[i / jmax];
+        b.flags = (uint32_t) batch.flags[i / jmax];
       }
 
       if (busopt.paired && getFragLenIfPaired && !busopt.long_read) {
         if (findFragmentLength && flengoal > 0 && u.cardinality() == 1 && !v.empty() && !v2.empty()) {
-          // try to map the reads
-          int tl = index.mapPair(seq, seqlen, seq2, seqlen2);
+          // try to map the reads, from the k-mers match() found (which
+          // are of the translated reads with --aa)
+          int tl = busopt.aa ? index.mapPair(seq, seqlen, seq2, seqlen2) : index.mapPair(v, v2);
           if (0 < tl && tl < flens.size()) {
             flens[tl]++;
             flengoal--;
@@ -1843,23 +1898,10 @@ void BUSProcessor::processBuffer() {
 	}
       }
 
-      // count the pseudoalignment
-      std::lock_guard<std::mutex> lock(mp.transfer_locks[local_id]);
-      auto elem = index.ecmapinv.find(u);
-      if (elem == index.ecmapinv.end()) {
-        // something we haven't seen before
-        //newEcs.push_back(u); // don't store newEcs (it's redundant)
-        newB.push_back({b, u});
-      } /*else if (elem->second >= counts.size()) {
-          newEcs.push_back(u);
-          newB.push_back({b, u});
-      } */ else {
-        // add to count vector
-        //++counts[elem->second]; // don't store counts; we have BUS records that we can count up
-        // push back BUS record
-        b.ec = elem->second;
-        bv.push_back(b);
-      }
+      // count the pseudoalignment, registering the ec if we haven't seen it before
+      // (no counts stored here; we have BUS records that we can count up)
+      b.ec = ec;
+      bv.push_back(b);
     }
 
     if (mp.opt.pseudobam) {
@@ -1889,20 +1931,15 @@ void BUSProcessor::processBuffer() {
 
 void BUSProcessor::clear() {
   numreads=0;
-  memset(buffer,0,bufsize);
-  newEcs.clear();
   counts.clear();
   //counts.resize(tc.counts.size(), 0);
   bv.clear();
-  newB.clear();
 }
 
 #ifndef NO_HTSLIB
 AlnProcessor::AlnProcessor(const KmerIndex& index, const ProgramOptions& opt, MasterProcessor& mp, const EMAlgorithm& em, const Transcriptome &model, bool useEM, int _id) :
- paired(!opt.single_end && !opt.long_read), index(index), mp(mp), em(em), model(model), useEM(useEM), id(_id) {
+ batch(mp.bufsize), paired(!opt.single_end && !opt.long_read), index(index), mp(mp), em(em), model(model), useEM(useEM), id(_id) {
    // initialize buffer
-   bufsize = mp.bufsize;
-   buffer = new char[bufsize];
    bambufsize = 1<<20;
    bambuffer = new char[bambufsize]; // refactor this?
 
@@ -1915,43 +1952,29 @@ AlnProcessor::AlnProcessor(const KmerIndex& index, const ProgramOptions& opt, Ma
      batchSR.paired = !opt.single_end && !opt.long_read;
    }
 
-   seqs.reserve(bufsize/50);
-
    clear();
 
 }
 
 
 AlnProcessor::AlnProcessor(AlnProcessor && o) :
+  batch(std::move(o.batch)),
+  bambufsize(o.bambufsize),
   paired(o.paired),
   index(o.index),
   em(o.em),
   mp(o.mp),
-  model(o.model),
-  id(o.id),
-  useEM(o.useEM),
-  bufsize(o.bufsize),
-  bambufsize(o.bambufsize),
+  batchSR(std::move(o.batchSR)),
   numreads(o.numreads),
-  seqs(std::move(o.seqs)),
-  names(std::move(o.names)),
-  quals(std::move(o.quals)),
-  flags(std::move(o.flags)),
-  umis(std::move(o.umis)),
-  batchSR(std::move(o.batchSR)) {
-    buffer = o.buffer;
-    o.buffer = nullptr;
-    o.bufsize = 0;
+  id(o.id),
+  model(o.model),
+  useEM(o.useEM) {
     bambuffer = o.bambuffer;
     o.bambuffer = nullptr;
     o.bambufsize = 0;
 }
 
 AlnProcessor::~AlnProcessor() {
-  if (buffer != nullptr) {
-    delete[] buffer;
-    buffer = nullptr;
-  }
   if (bambuffer != nullptr) {
     delete[] bambuffer;
     bambuffer = nullptr;
@@ -1960,7 +1983,6 @@ AlnProcessor::~AlnProcessor() {
 
 void AlnProcessor::clear() {
   numreads=0;
-  memset(buffer,0,bufsize);
   memset(bambuffer, 0, bambufsize);
   pseudobatch.aln.clear();
   pseudobatch.batch_id = -1;
@@ -1970,17 +1992,16 @@ void AlnProcessor::clear() {
 void AlnProcessor::operator()() {
   while (true) {
     clear();
-    int readbatch_id;
     // grab the reader lock
     if (mp.opt.batch_mode) {
       std::lock_guard<std::mutex> lock(mp.reader_lock);
       if (batchSR.empty()) {
         return;
       } else {
-        batchSR.fetchSequences(buffer, bufsize, seqs, names, quals, flags, umis, readbatch_id, true );
+        batchSR.fetchSequences(batch, true);
         readPseudoAlignmentBatch(mp.pseudobatchf_in, pseudobatch);
-        assert(pseudobatch.batch_id == readbatch_id);
-        assert(pseudobatch.aln.size() == ((paired) ? seqs.size()/2 : seqs.size())); // sanity checks
+        assert(pseudobatch.batch_id == batch.readbatch_id);
+        assert(pseudobatch.aln.size() == ((paired) ? batch.seqs.size()/2 : batch.seqs.size())); // sanity checks
       }
     } else {
       std::lock_guard<std::mutex> lock(mp.reader_lock);
@@ -1989,13 +2010,13 @@ void AlnProcessor::operator()() {
         return;
       } else {
         // get new sequences
-        mp.SR->fetchSequences(buffer, bufsize, seqs, names, quals, flags, umis, readbatch_id, true);
+        mp.SR->fetchSequences(batch, true);
         readPseudoAlignmentBatch(mp.pseudobatchf_in, pseudobatch);
-        assert(pseudobatch.batch_id == readbatch_id);
+        assert(pseudobatch.batch_id == batch.readbatch_id);
         if (mp.opt.bus_mode) {
-          assert(pseudobatch.aln.size() == seqs.size()/mp.opt.busOptions.nfiles); // sanity checks
+          assert(pseudobatch.aln.size() == batch.seqs.size()/mp.opt.busOptions.nfiles); // sanity checks
         } else {
-          assert(pseudobatch.aln.size() == ((paired) ? seqs.size()/2 : seqs.size())); // sanity checks
+          assert(pseudobatch.aln.size() == ((paired) ? batch.seqs.size()/2 : batch.seqs.size())); // sanity checks
         }
       }
       // release the reader lock
@@ -2035,10 +2056,10 @@ void AlnProcessor::processBufferTrans() {
     bam1_t b1,b2, b1c, b2c;
     int si1 = (paired) ? 2*i : i;
     int si2 = (paired) ? 2*i +1 : -1;
-    int rlen1 = seqs[si1].second;
+    int rlen1 = batch.seqs[si1].second;
     int rlen2;
     if (paired) {
-      rlen2 = seqs[si2].second;
+      rlen2 = batch.seqs[si2].second;
     }
 
     // fill in the bam core info
@@ -2068,9 +2089,9 @@ void AlnProcessor::processBufferTrans() {
     PseudoAlignmentInfo &pi = pseudobatch.aln[i];
 
     // fill in the data info
-    fillBamRecord(b1, nullptr, seqs[si1].first, names[si1].first,  quals[si1].first, seqs[si1].second, names[si1].second, pi.r1empty, trans_auxlen);
+    fillBamRecord(b1, nullptr, batch.seqs[si1].first, batch.names[si1].first,  batch.quals[si1].first, batch.seqs[si1].second, batch.names[si1].second, pi.r1empty, trans_auxlen);
     if (paired) {
-      fillBamRecord(b2, nullptr, seqs[si2].first, names[si2].first,  quals[si2].first, seqs[si2].second, names[si2].second, pi.r2empty, trans_auxlen);
+      fillBamRecord(b2, nullptr, batch.seqs[si2].first, batch.names[si2].first,  batch.quals[si2].first, batch.seqs[si2].second, batch.names[si2].second, pi.r2empty, trans_auxlen);
     }
 
     if (pi.r1empty && pi.r2empty) {
@@ -2099,7 +2120,7 @@ void AlnProcessor::processBufferTrans() {
       if (useEM) {
 
         double denom = 0.0;
-        const auto& wv = em.weight_map_[ec];
+        const double* wv = em.weights_->data() + em.ecs_->offsets[ec];
 
         for (int i = 0; i < nmap; ++i) {
           denom += em.alpha_[trs[i]] * wv[i];
@@ -2205,8 +2226,7 @@ void AlnProcessor::processBufferTrans() {
               return {false, reptrue};
             }
 
-            auto ecs = n->ec.get_leading_vals(val.dist);
-            const auto& v_ec = ecs[ecs.size() - 1];
+            const auto& v_ec = r;
             const Roaring& ec = v_ec.getIndices();
 
             uint32_t bitmask = 0x7FFFFFFF;
@@ -2233,12 +2253,12 @@ void AlnProcessor::processBufferTrans() {
         std::pair<bool,bool> strInfo1 = {true,true}, strInfo2 = {true,true};
 
         if (!pi.r1empty) {
-          km1 = Kmer(seqs[si1].first + pi.k1pos);
+          km1 = Kmer(batch.seqs[si1].first + pi.k1pos);
           strInfo1 = strandednessInfo(km1, val1, ua);
 
         }
         if (paired && !pi.r2empty) {
-          km2 = Kmer(seqs[si2].first + pi.k2pos);
+          km2 = Kmer(batch.seqs[si2].first + pi.k2pos);
           strInfo2 = strandednessInfo(km2, val2, ua);
         }
 
@@ -2328,7 +2348,7 @@ void AlnProcessor::processBufferTrans() {
             if (b1c.core.pos < 0) {
               b1c.core.pos = 0;
             }
-            b1c.core.bin = hts_reg2bin(b1c.core.pos, b1c.core.pos + seqs[si1].second-1, 14, 5);
+            b1c.core.bin = hts_reg2bin(b1c.core.pos, b1c.core.pos + batch.seqs[si1].second-1, 14, 5);
             b1c.core.qual = 255;
             if (useEM) {
               memcpy(b1c.data + b1c.l_data - 4, &prob, 4); // set ZW tag
@@ -2345,7 +2365,7 @@ void AlnProcessor::processBufferTrans() {
                 b2c.core.pos = 0;
               }
 
-              b2c.core.bin = hts_reg2bin(b2c.core.pos, b2c.core.pos + seqs[si2].second, 14, 5);
+              b2c.core.bin = hts_reg2bin(b2c.core.pos, b2c.core.pos + batch.seqs[si2].second, 14, 5);
               b2c.core.qual = 255;
               if (useEM) {
                 memcpy(b2c.data + b2c.l_data - 4, &prob, 4);
@@ -2476,12 +2496,12 @@ void AlnProcessor::processBufferGenome() {
         si2 = i*busopt.nfiles + busopt.seq[1].fileno;
       }
     }
-    int rlen1 = seqs[si1].second;
+    int rlen1 = batch.seqs[si1].second;
     int rlen2;
     int seq1_offset = 0;
     int seq2_offset = 0;
     if (paired) {
-      rlen2 = seqs[si2].second;
+      rlen2 = batch.seqs[si2].second;
     }
 
     // fill in the bam core info
@@ -2512,10 +2532,10 @@ void AlnProcessor::processBufferGenome() {
 
     if (!mp.opt.bus_mode) {
       // fill in the data info
-      fillBamRecord(b1, nullptr, seqs[si1].first, names[si1].first,  quals[si1].first, seqs[si1].second, names[si1].second, pi.r1empty, genome_auxlen);
+      fillBamRecord(b1, nullptr, batch.seqs[si1].first, batch.names[si1].first,  batch.quals[si1].first, batch.seqs[si1].second, batch.names[si1].second, pi.r1empty, genome_auxlen);
       //b1.id = idnum++;
       if (paired) {
-        fillBamRecord(b2, nullptr, seqs[si2].first, names[si2].first,  quals[si2].first, seqs[si2].second, names[si2].second, pi.r2empty, genome_auxlen);
+        fillBamRecord(b2, nullptr, batch.seqs[si2].first, batch.names[si2].first,  batch.quals[si2].first, batch.seqs[si2].second, batch.names[si2].second, pi.r2empty, genome_auxlen);
         // b2.id = idnum++;
       }
     }
@@ -2529,19 +2549,19 @@ void AlnProcessor::processBufferGenome() {
 
       // fill in the data info
       if (tag_present && umi_first_file) {
-        rlen1 = seqs[si1].second-tagseqstart;
+        rlen1 = batch.seqs[si1].second-tagseqstart;
         seq1_offset = tagseqstart;
-        fillBamRecord(b1, nullptr, seqs[si1].first+tagseqstart, names[si1].first,  quals[si1].first+tagseqstart, seqs[si1].second-tagseqstart, names[si1].second, pi.r1empty, genome_auxlen);
+        fillBamRecord(b1, nullptr, batch.seqs[si1].first+tagseqstart, batch.names[si1].first,  batch.quals[si1].first+tagseqstart, batch.seqs[si1].second-tagseqstart, batch.names[si1].second, pi.r1empty, genome_auxlen);
       } else {
-        fillBamRecord(b1, nullptr, seqs[si1].first, names[si1].first,  quals[si1].first, seqs[si1].second, names[si1].second, pi.r1empty, genome_auxlen);
+        fillBamRecord(b1, nullptr, batch.seqs[si1].first, batch.names[si1].first,  batch.quals[si1].first, batch.seqs[si1].second, batch.names[si1].second, pi.r1empty, genome_auxlen);
       }
       if (paired) {
         if (tag_present && !umi_first_file) {
-          rlen2 = seqs[si2].second-tagseqstart;
+          rlen2 = batch.seqs[si2].second-tagseqstart;
           seq2_offset = tagseqstart;
-          fillBamRecord(b2, nullptr, seqs[si2].first+tagseqstart, names[si2].first,  quals[si2].first+tagseqstart, seqs[si2].second-tagseqstart, names[si2].second, pi.r2empty, genome_auxlen);
+          fillBamRecord(b2, nullptr, batch.seqs[si2].first+tagseqstart, batch.names[si2].first,  batch.quals[si2].first+tagseqstart, batch.seqs[si2].second-tagseqstart, batch.names[si2].second, pi.r2empty, genome_auxlen);
         } else {
-          fillBamRecord(b2, nullptr, seqs[si2].first, names[si2].first,  quals[si2].first, seqs[si2].second, names[si2].second, pi.r2empty, genome_auxlen);
+          fillBamRecord(b2, nullptr, batch.seqs[si2].first, batch.names[si2].first,  batch.quals[si2].first, batch.seqs[si2].second, batch.names[si2].second, pi.r2empty, genome_auxlen);
         }
       }
 
@@ -2600,7 +2620,7 @@ void AlnProcessor::processBufferGenome() {
       if (useEM) {
 
         double denom = 0.0;
-        const auto& wv = em.weight_map_[ec];
+        const double* wv = em.weights_->data() + em.ecs_->offsets[ec];
 
         for (int i = 0; i < nmap; ++i) {
           denom += em.alpha_[trs[i]] * wv[i];
@@ -2691,8 +2711,7 @@ void AlnProcessor::processBufferGenome() {
               return {false, reptrue};
             }
 
-            auto ecs = n->ec.get_leading_vals(val.dist);
-            const auto& v_ec = ecs[ecs.size() - 1];
+            const auto& v_ec = r;
             const Roaring& ec = v_ec.getIndices();
 
             uint32_t bitmask = 0x7FFFFFFF;
@@ -2719,11 +2738,11 @@ void AlnProcessor::processBufferGenome() {
         std::pair<bool,bool> strInfo1 = {true,true}, strInfo2 = {true,true};
 
         if (!pi.r1empty) {
-          km1 = Kmer(seqs[si1].first + seq1_offset + pi.k1pos);
+          km1 = Kmer(batch.seqs[si1].first + seq1_offset + pi.k1pos);
           strInfo1 = strandednessInfo(km1, val1, ua);
         }
         if (paired && !pi.r2empty) {
-          km2 = Kmer(seqs[si2].first + seq2_offset + pi.k2pos);
+          km2 = Kmer(batch.seqs[si2].first + seq2_offset + pi.k2pos);
           strInfo2 = strandednessInfo(km2, val2, ua);
         }
 
@@ -2843,7 +2862,7 @@ void AlnProcessor::processBufferGenome() {
           b1c.core.tid = tra.first.chr;
           if (!pi.r1empty) {
             b1c.core.pos = tra.first.chrpos;
-            b1c.core.bin = hts_reg2bin(b1c.core.pos, b1c.core.pos + seqs[si1].second-seq1_offset-1, 14, 5);
+            b1c.core.bin = hts_reg2bin(b1c.core.pos, b1c.core.pos + batch.seqs[si1].second-seq1_offset-1, 14, 5);
             b1c.core.qual = 255;
             if (useEM) {
               memcpy(b1c.data + b1c.l_data - 4, &prob, 4); // set ZW tag
@@ -2854,7 +2873,7 @@ void AlnProcessor::processBufferGenome() {
             b2c.core.tid = tra.second.chr;
             if (!pi.r2empty) {
               b2c.core.pos = tra.second.chrpos;
-              b2c.core.bin = hts_reg2bin(b2c.core.pos, b2c.core.pos + seqs[si2].second-seq2_offset, 14, 5);
+              b2c.core.bin = hts_reg2bin(b2c.core.pos, b2c.core.pos + batch.seqs[si2].second-seq2_offset, 14, 5);
               b2c.core.qual = 255;
               if (useEM) {
                 memcpy(b2c.data + b2c.l_data - 4, &prob, 4);
@@ -3138,6 +3157,8 @@ FastqSequenceReader::~FastqSequenceReader() {
       gzclose(f);
     }
   }
+  inflaters.clear();
+  leases.clear();
   for (auto &s : seq) {
     kseq_destroy(s);
   }
@@ -3157,6 +3178,16 @@ void FastqSequenceReader::reset() {
     }
     f = nullptr;
   }
+  for (auto &z : inflaters) {
+    z.reset();
+  }
+  for (auto &m : maps) {
+    m.reset();
+  }
+  for (auto &sc : scanners) {
+    sc.reset();
+  }
+  leases.clear();
 
   for (auto &ll : l) {
     ll = 0;
@@ -3177,29 +3208,118 @@ void FastqSequenceReader::reserveNfiles(int n) {
   l.resize(nfiles, 0);
   nl.resize(nfiles, 0);
   seq.resize(nfiles, nullptr);
+  inflaters.resize(nfiles);
+  maps.resize(nfiles);
+  scanners.resize(nfiles);
+  recs.resize(nfiles);
+}
+
+void FastqSequenceReader::openFile(int i, const char* buf) {
+  if (files[0] == "-" && nfiles == 1) {
+    fp[i] = gzdopen(fileno(stdin), "r");
+    seq[i] = kseq_init(fp[i]);
+    return;
+  }
+  maps[i] = MappedFastq::open(files[current_file+i]);
+  if (maps[i]) {
+    maps[i]->pin(maps[i]->begin());
+    leases[buf].emplace_back(maps[i], maps[i]->begin());
+  } else {
+    fp[i] = ParallelGzip::open(files[current_file+i], threads, inflaters[i]);
+    scanners[i].reset(new FastqScanner(fp[i]));
+  }
+}
+
+// kseq on f, carrying on where scanner stopped: its stream starts out with
+// the bytes the scanner read ahead and then reads f as usual.
+static kseq_t* kseqAfter(gzFile f, const FastqScanner& scanner) {
+  kseq_t* ks = kseq_init(f);
+  size_t n = scanner.restSize();
+  if (n > 0) {
+    kstream_t* s = ks->f;
+    // refills read up to KSEQ_INIT's buffer size into buf
+    s->buf = (unsigned char*) realloc(s->buf, std::max<size_t>(n, 16384));
+    memcpy(s->buf, scanner.rest(), n);
+    s->begin = 0;
+    s->end = n;
+  }
+  return ks;
+}
+
+// As kseq_read, for the file last opened as file i, into recs[i]. Records
+// that are not four plain lines are left to kseq.
+int FastqSequenceReader::readRecord(int i) {
+  if (maps[i] || scanners[i]) {
+    int r = maps[i] ? maps[i]->read(recs[i]) : scanners[i]->read(recs[i]);
+    if (r != -2) {
+      return r;
+    }
+    // kseq reads the rest of the file, from that record on
+    if (maps[i]) {
+      // a mapped file is a regular uncompressed one, so it can be reopened
+      // and seeked in place
+      uint64_t off = maps[i]->begin();
+      maps[i].reset();
+      fp[i] = gzopen(files[current_file-nfiles+i].c_str(), "r");
+      gzseek(fp[i], off, SEEK_SET);
+      seq[i] = kseq_init(fp[i]);
+    } else {
+      // anything else could be a pipe, or gzip that a reopen would inflate
+      // again from the start, so kseq goes on reading the same stream
+      seq[i] = kseqAfter(fp[i], *scanners[i]);
+      scanners[i].reset();
+    }
+  }
+  int r = kseq_read(seq[i]);
+  if (r >= 0) {
+    kseq_t* ks = seq[i];
+    recs[i] = {ks->name.s, (int) ks->name.l, ks->comment.s, (int) ks->comment.l, ks->seq.s, ks->qual.s};
+  }
+  return r;
+}
+
+// the UMI in the RX:Z: tag of a FASTQ comment of length len
+static void extractUmi(const char* comment, size_t len, std::vector<std::pair<const char*, int>>& umis) {
+  const char* end = comment + len;
+  const char* umi_pos = (const char*) memmem(comment, len, "RX:Z:", 5);
+  if (umi_pos != nullptr) {
+    const char* umi_end = (const char*) memchr(umi_pos, ' ', end-umi_pos); // Check for space
+    if (umi_end == nullptr) {
+      umi_end = (const char*) memchr(umi_pos, '\t', end-umi_pos); // Check for tab
+    }
+    umis.emplace_back(umi_pos+5, (umi_end != nullptr ? umi_end : end) - (umi_pos+5));
+  }
 }
 
 // returns true if there is more left to read from the files
-bool FastqSequenceReader::fetchSequences(char *buf, const int limit, std::vector<std::pair<const char *, int> > &seqs,
-  std::vector<std::pair<const char *, int> > &names,
-  std::vector<std::pair<const char *, int> > &quals,
-  std::vector<uint32_t>& flags,
-  std::vector<std::string> &umis, int& read_id,
-  bool full,
-  bool comments) {
-
-  std::string line;
-  std::string umi;
+bool FastqSequenceReader::fetchSequences(ReadBatch& batch, bool full, bool comments) {
+
+  char* buf = batch.buffer;
+  const int limit = batch.bufsize;
+  auto& seqs = batch.seqs;
+  auto& names = batch.names;
+  auto& quals = batch.quals;
+  auto& flags = batch.flags;
+  auto& umis = batch.umis;
   readbatch_id += 1; // increase the batch id
-  read_id = readbatch_id; // copy now because we are inside a lock
-  seqs.clear();
-  umis.clear();
+  batch.readbatch_id = readbatch_id; // copy now because we are inside a lock
+  batch.clear();
   if (comments) full = true; // Auto-set to full if comments is true
-  if (full) {
-    names.clear();
-    quals.clear();
+
+  // what was handed out in this buffer before is done with
+  auto& held = leases[buf];
+  for (auto& h : held) {
+    h.first->unpin(h.second);
+  }
+  held.clear();
+  if (state) {
+    for (auto& m : maps) {
+      if (m) {
+        m->pin(m->begin());
+        held.emplace_back(m, m->begin());
+      }
+    }
   }
-  flags.clear();
 
   int bufpos = 0;
   int pad = nfiles; //(paired) ? 2 : 1;
@@ -3215,16 +3335,27 @@ bool FastqSequenceReader::fetchSequences(char *buf, const int limit, std::vector
           if (f) {
             gzclose(f);
           }
+          f = nullptr;
+        }
+        for (auto &s : seq) {
+          kseq_destroy(s);
+          s = nullptr;
+        }
+        for (auto &m : maps) {
+          m.reset();
+        }
+        for (auto &sc : scanners) {
+          sc.reset();
         }
 
         // open the next one
         for (int i = 0; i < nfiles; i++) {
-          fp[i] = files[0] == "-" && nfiles == 1 ? gzdopen(fileno(stdin), "r") : gzopen(files[current_file+i].c_str(), "r");
-          seq[i] = kseq_init(fp[i]);
-          l[i] = kseq_read(seq[i]);
-
+          openFile(i, buf);
         }
         current_file+=nfiles;
+        for (int i = 0; i < nfiles; i++) {
+          l[i] = readRecord(i);
+        }
         state = true;
       }
     }
@@ -3239,7 +3370,7 @@ bool FastqSequenceReader::fetchSequences(char *buf, const int limit, std::vector
       // fits into the buffer
       if (full) {
         for (int i = 0; i < nfiles; i++) {
-          nl[i] = seq[i]->name.l + (comments ? seq[i]->comment.l+1 : 0);
+          nl[i] = recs[i].name_len + (comments ? recs[i].comment_len+1 : 0);
           bufadd += l[i] + nl[i]; // includes name and qual
         }
         bufadd += 2*pad;
@@ -3255,49 +3386,39 @@ bool FastqSequenceReader::fetchSequences(char *buf, const int limit, std::vector
         }
 
         for (int i = 0; i < nfiles; i++) {
+          const auto& r = recs[i];
+          const char* comment = r.comment;
           char *pi = buf + bufpos;
-          memcpy(pi, seq[i]->seq.s, l[i]+1);
+          memcpy(pi, r.seq, l[i]);
+          pi[l[i]] = '\0';
           bufpos += l[i]+1;
           seqs.emplace_back(pi,l[i]);
 
-          if (full && !comments) {
-            pi = buf + bufpos;
-            memcpy(pi, seq[i]->qual.s,l[i]+1);
-            bufpos += l[i]+1;
-            quals.emplace_back(pi,l[i]);
-            pi = buf + bufpos;
-            memcpy(pi, seq[i]->name.s, nl[i]+1);
-            bufpos += nl[i]+1;
-            names.emplace_back(pi, nl[i]);
-          } else if (full && comments) {
+          if (full && maps[i]) {
+            // names and qualities point into the file, buf is counted as
+            // when copying them so the batches come out the same
+            quals.emplace_back(r.qual, l[i]);
+            names.emplace_back(r.name, r.name_len);
+            bufpos += l[i]+1 + nl[i]+1;
+          } else if (full) {
             pi = buf + bufpos;
-            memcpy(pi, seq[i]->qual.s,l[i]+1);
+            memcpy(pi, r.qual, l[i]);
+            pi[l[i]] = '\0';
             bufpos += l[i]+1;
             quals.emplace_back(pi,l[i]);
             pi = buf + bufpos;
-            memcpy(pi, seq[i]->name.s, (nl[i]-(seq[i]->comment.l+1)));
-            names.emplace_back(pi, (nl[i]-(seq[i]->comment.l+1)));
-            bufpos += (nl[i]-(seq[i]->comment.l+1));
-            pi = buf + bufpos;
-            const char* blank_space = " ";
-            memcpy(pi, blank_space, 1);
-            bufpos += 1;
-            pi = buf + bufpos;
-            memcpy(pi, seq[i]->comment.s, seq[i]->comment.l+1);
-            bufpos += seq[i]->comment.l+1;
-            // Extract UMI:
-            const char* umi_pos = strstr(seq[i]->comment.s, "RX:Z:");
-            if (umi_pos != nullptr) {
-              size_t umi_extra_length = 0;
-              const char* space_pos = strstr(umi_pos, " "); // Check for space
-              if (space_pos != nullptr) {
-                umi_extra_length = space_pos != nullptr ? space_pos-umi_pos-5 : 0;
-              } else {
-                const char* tab_pos = strstr(umi_pos, "\t"); // Check for tab
-                umi_extra_length = tab_pos != nullptr ? tab_pos-umi_pos-5 : 0;
-              }
-              umis.emplace_back(umi_extra_length == 0 ? std::string(umi_pos+5) : std::string(umi_pos+5, umi_extra_length));
+            memcpy(pi, r.name, r.name_len);
+            names.emplace_back(pi, r.name_len);
+            if (comments) { // the name runs on into the comment
+              pi[r.name_len] = ' ';
+              memcpy(pi + r.name_len + 1, r.comment, r.comment_len);
+              comment = pi + r.name_len + 1; // kseq's copy is gone by the next record
             }
+            pi[nl[i]] = '\0';
+            bufpos += nl[i]+1;
+          }
+          if (comments) {
+            extractUmi(comment, r.comment_len, umis);
           }
         }
 
@@ -3313,7 +3434,7 @@ bool FastqSequenceReader::fetchSequences(char *buf, const int limit, std::vector
 
       // read for the next one
       for (int i = 0; i < nfiles; i++) {
-        l[i] = kseq_read(seq[i]);
+        l[i] = readRecord(i);
       }
     } else {
       state = false; // haven't opened file yet
@@ -3333,12 +3454,22 @@ FastqSequenceReader::FastqSequenceReader(FastqSequenceReader&& o) :
   files(std::move(o.files)),
   current_file(o.current_file),
   interleave_nfiles(o.interleave_nfiles),
-  seq(std::move(o.seq)) {
+  seq(std::move(o.seq)),
+  threads(o.threads),
+  inflaters(std::move(o.inflaters)),
+  maps(std::move(o.maps)),
+  scanners(std::move(o.scanners)),
+  recs(std::move(o.recs)),
+  leases(std::move(o.leases)) {
 
   o.fp.resize(nfiles);
   o.l.resize(nfiles, 0);
   o.nl.resize(nfiles, 0);
   o.seq.resize(nfiles, nullptr);
+  o.inflaters.resize(nfiles);
+  o.maps.resize(nfiles);
+  o.scanners.resize(nfiles);
+  o.recs.resize(nfiles);
   o.state = false;
 }
 
@@ -3369,17 +3500,14 @@ void BamSequenceReader::reserveNfiles(int n) {
 }
 
 // returns true if there is more left to read from the files
-bool BamSequenceReader::fetchSequences(char *buf, const int limit, std::vector<std::pair<const char *, int> > &seqs,
-  std::vector<std::pair<const char *, int> > &names,
-  std::vector<std::pair<const char *, int> > &quals,
-  std::vector<uint32_t>& flags,
-  std::vector<std::string> &umis, int& read_id,
-  bool full, bool comments) {
+bool BamSequenceReader::fetchSequences(ReadBatch& batch, bool full, bool comments) {
 
+  char* buf = batch.buffer;
+  const int limit = batch.bufsize;
+  auto& seqs = batch.seqs;
   readbatch_id += 1; // increase the batch id
-  read_id = readbatch_id; // copy now because we are inside a lock
-  seqs.clear();
-  flags.clear();
+  batch.readbatch_id = readbatch_id; // copy now because we are inside a lock
+  batch.clear();
 
   int bufpos = 0;
   while (true) {
@@ -21,6 +21,10 @@
 #include "GeneModel.h"
 #include "BUSData.h"
 #include "BUSTools.h"
+#include "ConcurrentEcMap.hpp"
+#include "hash.hpp"
+#include "ParallelGzip.h"
+#include "MappedFastq.h"
 
 #ifndef NO_HTSLIB
 #include <htslib/kstring.h>
@@ -29,11 +33,132 @@
 
 class MasterProcessor;
 
+// Per-batch EC counts. The dense vector is indexed by EC id and is only
+// nonzero at the ECs listed in `ecs`, so merging and clearing a batch
+// costs the number of distinct ECs it hit rather than the size of the
+// EC map.
+struct ECCountDelta {
+  std::vector<uint32_t> dense;
+  std::vector<int32_t> ecs;
+
+  void add(int32_t ec) {
+    if ((size_t) ec >= dense.size()) {
+      dense.resize(ec+1, 0);
+    }
+    if (dense[ec]++ == 0) {
+      ecs.push_back(ec);
+    }
+  }
+  void clear() {
+    for (auto ec : ecs) {
+      dense[ec] = 0;
+    }
+    ecs.clear();
+  }
+};
+
+// Bounded per-thread memo of read sequence to final EC (-1 when the read
+// does not pseudoalign), for libraries with many exact duplicate reads.
+// Direct mapped by a hash of the mates. The mates themselves are kept, so
+// a hash collision is a miss and never a wrong EC. The caller must only
+// use it while the EC depends on nothing but the key; `tag` folds in
+// any per-read switch that changes the outcome. The capacity is rounded
+// up to a power of two; a cache of capacity 0 must not be used.
+class ReadECCache {
+public:
+  explicit ReadECCache(size_t capacity = 1ULL<<14) : slots(round_up(capacity)), slot(nullptr), hits(0), misses(0) {}
+
+  size_t capacity() const {
+    return slots.size();
+  }
+
+  // s2 is nullptr for single reads
+  bool find(const char *s1, int l1, const char *s2, int l2, char tag, int32_t& ec) {
+    key.assign(s1, l1);
+    if (s2 != nullptr) {
+      key.push_back('\n');
+      key.append(s2, l2);
+    }
+    key.push_back(tag);
+    uint64_t h;
+    MurmurHash3_x64_64(key.data(), key.size(), 0, &h);
+    slot = &slots[h & (slots.size()-1)];
+    if (slot->filled && slot->seq == key) {
+      ec = slot->ec;
+      hits++;
+      return true;
+    }
+    misses++;
+    return false;
+  }
+
+  // records the EC of the reads passed to the last find()
+  void insert(int32_t ec) {
+    slot->seq.swap(key);
+    slot->ec = ec;
+    slot->filled = true;
+  }
+
+  void clear() {
+    for (auto& e : slots) {
+      e.filled = false;
+    }
+  }
+
+private:
+  struct Entry {
+    std::string seq;
+    int32_t ec = -1;
+    bool filled = false;
+  };
+
+  static size_t round_up(size_t capacity) {
+    size_t n = (capacity > 0) ? 1 : 0;
+    while (n < capacity) {
+      n <<= 1;
+    }
+    return n;
+  }
+
+  std::vector<Entry> slots; // size is a power of two
+  std::string key;
+  Entry* slot;
+
+public:
+  size_t hits;
+  size_t misses;
+};
+
 int64_t ProcessReads(MasterProcessor& MP, const  ProgramOptions& opt);
 int64_t ProcessBatchReads(MasterProcessor& MP, const ProgramOptions& opt);
 int64_t ProcessBUSReads(MasterProcessor& MP, const ProgramOptions& opt);
 int findFirstMappingKmer(const std::vector<std::pair<UnitigMap<Node>&, int>> &v, UnitigMap<Node>& um);
 
+// The reads of one batch, as a reader fills it and a processor works
+// through it. buffer is an arena of bufsize bytes the reads are copied
+// into, each sequence '\0' terminated; seqs, names, quals and umis point
+// into it, or into an input file the reader has mapped. Batches are
+// reused: every fetch drops the views and writes over the arena, which is
+// neither freed nor zeroed in between.
+class ReadBatch {
+public:
+  explicit ReadBatch(size_t bufsize = 0);
+  ReadBatch(ReadBatch&& o);
+  ~ReadBatch();
+
+  void clear(); // the views only
+  void swap(ReadBatch& o);
+
+  char* buffer;
+  size_t bufsize;
+  std::vector<std::pair<const char*, int>> seqs;
+  std::vector<std::pair<const char*, int>> names;
+  std::vector<std::pair<const char*, int>> quals;
+  std::vector<uint32_t> flags;
+  std::vector<std::pair<const char*, int>> umis; // from the RX:Z: tags, if comments are read
+  int readbatch_id;
+};
+
 class SequenceReader {
 public:
 
@@ -46,13 +171,7 @@ public:
   virtual bool empty() = 0;
   virtual void reset();
   virtual void reserveNfiles(int n) = 0;
-  virtual bool fetchSequences(char *buf, const int limit, std::vector<std::pair<const char*, int>>& seqs,
-                      std::vector<std::pair<const char*, int>>& names,
-                      std::vector<std::pair<const char*, int>>& quals,
-                      std::vector<uint32_t>& flags,
-                      std::vector<std::string>& umis, int &readbatch_id,
-                      bool full=false,
-                      bool comments=false) = 0;
+  virtual bool fetchSequences(ReadBatch& batch, bool full=false, bool comments=false) = 0;
 
 
 public:
@@ -65,7 +184,7 @@ public:
 
   FastqSequenceReader(const ProgramOptions& opt) : SequenceReader(opt),
   current_file(0), paired(!opt.single_end && !opt.long_read),
-  f_umi(new std::ifstream{}) {
+  f_umi(new std::ifstream{}), threads(opt.threads) {
     SequenceReader::state = false;
     files = opt.files;
 
@@ -77,24 +196,24 @@ public:
     }
     if (interleave_nfiles != 0) { nfiles = 1; files.clear(); files.push_back(opt.files[0]); }
     reserveNfiles(nfiles);
+    // the files are read side by side, so they split the threads
+    threads = std::max(1, opt.threads / nfiles);
   }
   FastqSequenceReader() : SequenceReader(),
   paired(false),
   f_umi(new std::ifstream{}),
-  current_file(0), interleave_nfiles(0) {};
+  current_file(0), interleave_nfiles(0), threads(1) {};
   FastqSequenceReader(FastqSequenceReader &&o);
   ~FastqSequenceReader();
 
   bool empty();
   void reset();
   void reserveNfiles(int n);
-  bool fetchSequences(char *buf, const int limit, std::vector<std::pair<const char*, int>>& seqs,
-                      std::vector<std::pair<const char*, int>>& names,
-                      std::vector<std::pair<const char*, int>>& quals,
-                      std::vector<uint32_t>& flags,
-                      std::vector<std::string>& umis, int &readbatch_id,
-                      bool full=false,
-                      bool comments=false);
+  bool fetchSequences(ReadBatch& batch, bool full=false, bool comments=false);
+
+private:
+  void openFile(int i, const char* buf);
+  int readRecord(int i);
 
 public:
   int nfiles = 1;
@@ -108,6 +227,14 @@ public:
   int current_file;
   std::vector<kseq_t*> seq;
   int interleave_nfiles;
+  int threads; // for inflating each gzip file that can be split
+  std::vector<std::unique_ptr<ParallelGzip>> inflaters; // per file in fp, closed after it
+  std::vector<std::shared_ptr<MappedFastq>> maps; // uncompressed files, read in place of fp
+  std::vector<std::unique_ptr<FastqScanner>> scanners; // read fp in place of kseq
+  std::vector<FastqRecord> recs; // the record last read from each file
+  // the records handed out in a buffer are pinned until the buffer is
+  // passed in again
+  std::unordered_map<const char*, std::vector<std::pair<std::shared_ptr<MappedFastq>, uint64_t>>> leases;
 };
 
 #ifndef NO_HTSLIB
@@ -145,13 +272,7 @@ public:
   bool empty();
   void reset();
   void reserveNfiles(int n);
-  bool fetchSequences(char *buf, const int limit, std::vector<std::pair<const char*, int>>& seqs,
-                      std::vector<std::pair<const char*, int>>& names,
-                      std::vector<std::pair<const char*, int>>& quals,
-                      std::vector<uint32_t>& flags,
-                      std::vector<std::string>& umis, int &readbatch_id,
-                      bool full=false,
-                      bool comments=false);
+  bool fetchSequences(ReadBatch& batch, bool full=false, bool comments=false);
 
 public:
   BGZF *fp;
@@ -171,11 +292,57 @@ private:
 };
 #endif
 
+// Reads batches ahead of the processors on a thread of its own, so that
+// decompressing and parsing the input overlaps with processing the reads
+// instead of one processor doing it under reader_lock while the others
+// wait. The batches circulate: next() trades the batch a processor is done
+// with for the next filled one. Batches are filled in input
+// order, so readbatch_id numbers them as before.
+class ReadAhead {
+public:
+  ReadAhead(SequenceReader& SR, size_t bufsize, int n_batches, bool full, bool comments);
+  ~ReadAhead();
+
+  // Swaps batch with the next filled one; false once the input is
+  // exhausted.
+  bool next(ReadBatch& batch);
+
+private:
+  // Bounded FIFO of batches. There are never more batches than its
+  // capacity, so push() does not wait; pop() waits for a batch and returns
+  // false once the queue is closed and drained.
+  class Queue {
+  public:
+    explicit Queue(size_t capacity) : ring(capacity), head(0), n(0), closed(false) {}
+    void push(ReadBatch* b);
+    bool pop(ReadBatch*& b);
+    void close();
+
+  private:
+    std::vector<ReadBatch*> ring;
+    size_t head;
+    size_t n;
+    bool closed;
+    std::mutex lock;
+    std::condition_variable cv;
+  };
+
+  void run();
+
+  SequenceReader& SR;
+  bool full;
+  bool comments;
+  std::vector<ReadBatch> batches;
+  Queue filled;
+  Queue empty;
+  std::thread reader;
+};
+
 class MasterProcessor {
 public:
   MasterProcessor (KmerIndex &index, const ProgramOptions& opt, MinCollector &tc, const Transcriptome& model)
-    : tc(tc), index(index), model(model), opt(opt), numreads(0), transfer_threshold(1), counter(0)
-    ,nummapped(0), num_umi(0), bufsize(1ULL<<23), tlencount(0), biasCount(0), maxBiasCount((opt.bias) ? 1000000 : 0), last_pseudobatch_id (-1) {
+    : ecmap(index.ecmapinv.size() + (1ULL<<16)), tc(tc), index(index), model(model), opt(opt), numreads(0), counter(0)
+    ,nummapped(0), num_umi(0), bufsize(1ULL<<23), tlencount(0), biasCount(0), maxBiasCount((opt.bias) ? 1000000 : 0), ec_cache_hits(0), ec_cache_misses(0), last_pseudobatch_id (-1) {
 
       #ifndef NO_HTSLIB
       bamfp = nullptr;
@@ -192,8 +359,15 @@ public:
         SR = new FastqSequenceReader(opt);
       }
       
-      std::vector<std::mutex> mutexes(opt.threads);
-      transfer_locks.swap(mutexes);
+      // seed the shared EC map with the ECs the index already knows, under
+      // the same ids; index.ecmapinv is left alone until transferECs()
+      std::vector<const ECKey*> known(index.ecmapinv.size());
+      for (const auto& x : index.ecmapinv) {
+        known[x.second] = &x.first;
+      }
+      for (auto k : known) {
+        ecmap.adopt(*k);
+      }
 
       if (opt.batch_mode) { // Set up recording of lengths individually for each batch
         if (opt.long_read) {
@@ -275,16 +449,19 @@ public:
   std::vector<std::mutex> parallel_bus_reader_locks;
   bool parallel_bus_read;
   std::mutex writer_lock;
-  std::vector<std::mutex> transfer_locks; // one mutex per thread; for locking each thread's access to index.ecmapinv
-  size_t transfer_threshold;
+  // every EC seen while processing; moved into index.ecmapinv afterwards.
+  // Starts with room for the index's ECs and 64k new ones
+  ConcurrentEcMap ecmap;
 
 
   SequenceReader *SR;
+  std::unique_ptr<ReadAhead> read_ahead; // reads SR while the processors run
   std::vector<FastqSequenceReader> FSRs;
   MinCollector& tc;
   KmerIndex& index;
   const Transcriptome& model;
   const int numSortFiles = 32;
+  const int read_ahead_batches = 4;
 
   const ProgramOptions& opt;
   int64_t numreads;
@@ -304,9 +481,8 @@ public:
   std::vector<std::vector<uint32_t>> batchFlens_lr_c;
   std::vector<std::vector<int32_t>> tmp_bc;
   const int maxBiasCount;
-  u_map_<Roaring, uint32_t, RoaringHasher> newECcount;
-  //  std::vector<std::pair<BUSData, std::vector<int32_t>>> newB;
-  u_map_<Roaring, int32_t, RoaringHasher> bus_ecmapinv;
+  std::atomic<size_t> ec_cache_hits; // summed over the processors' ReadECCache
+  std::atomic<size_t> ec_cache_misses;
   std::vector<int> batch_id_mapping; // minimal perfect mapping of batch ID
 
   std::ofstream ofusion;
@@ -326,17 +502,16 @@ public:
   void writeSortedPseudobam(const std::vector<std::vector<bam1_t>> &bvv);
   #endif
   std::vector<uint64_t> breakpoints;
-  void update(const std::vector<uint32_t>& c, const std::vector<Roaring>& newEcs, std::vector<std::pair<Roaring, std::string>>& ec_umi, std::vector<std::pair<Roaring, std::string>> &new_ec_umi, int n, std::vector<int>& flens, std::vector<int>& flens_lr, std::vector<int>& flens_lr_c, std::vector<int> &bias, const PseudoAlignmentBatch& pseudobatch, std::vector<BUSData> &bv, std::vector<std::pair<BUSData, Roaring>> newB, int *bc_len, int *umi_len,   int id = -1, int local_id = -1);
+  void transferECs();
+  void update(const ECCountDelta& c, std::vector<std::pair<Roaring, std::string>>& ec_umi, std::vector<std::pair<Roaring, std::string>> &new_ec_umi, int n, std::vector<int>& flens, std::vector<int>& flens_lr, std::vector<int>& flens_lr_c, std::vector<int> &bias, const PseudoAlignmentBatch& pseudobatch, std::vector<BUSData> &bv, int *bc_len, int *umi_len,   int id = -1, int local_id = -1);
 };
 
 class ReadProcessor {
 public:
   ReadProcessor(const KmerIndex& index, const ProgramOptions& opt, const MinCollector& tc, MasterProcessor& mp, int id = -1, int local_id = -1);
   ReadProcessor(ReadProcessor && o);
-  ~ReadProcessor();
-  char *buffer;
+  ReadBatch batch;
 
-  size_t bufsize;
   bool paired;
   const MinCollector& tc;
   std::vector<std::pair<Roaring, std::string>> ec_umi;
@@ -349,18 +524,14 @@ public:
   int local_id;
   PseudoAlignmentBatch pseudobatch;
 
-  std::vector<std::pair<const char*, int>> seqs;
-  std::vector<std::pair<const char*, int>> names;
-  std::vector<std::pair<const char*, int>> quals;
-  std::vector<uint32_t> flags;
-  std::vector<std::string> umis;
-  std::vector<Roaring> newEcs;
   std::vector<int> flens;
   std::vector<int> flens_lr;
   std::vector<int> flens_lr_c;
   std::vector<int> bias5;
 
-  std::vector<uint32_t> counts;
+  ECCountDelta counts;
+  ReadECCache ec_cache;
+  bool ec_cache_has_mean_fl; // overhang filtering state the cached ECs were computed under
 
   void operator()();
   void processBuffer();
@@ -371,10 +542,8 @@ class BUSProcessor {
 public:
   BUSProcessor(/*const*/ KmerIndex& index, const ProgramOptions& opt, const MinCollector& tc, MasterProcessor& mp, int id = -1, int local_id = -1);
   BUSProcessor(BUSProcessor && o);
-  ~BUSProcessor();
-  char *buffer;
+  ReadBatch batch;
 
-  size_t bufsize;
   bool paired;
   bool bam;
   bool num;
@@ -390,20 +559,13 @@ public:
   int bc_len[33];
   int umi_len[33];
 
-  std::vector<std::pair<const char*, int>> seqs;
-  std::vector<std::pair<const char*, int>> names;
-  std::vector<std::pair<const char*, int>> quals;
-  std::vector<std::string> umis;
-  std::vector<uint32_t> flags;
-
-  std::vector<Roaring> newEcs;
   std::vector<int> flens;
   std::vector<int> flens_lr;
   std::vector<int> flens_lr_c;
   std::vector<int> bias5;
-  std::vector<uint32_t> counts;
+  ECCountDelta counts;
   std::vector<BUSData> bv;
-  std::vector<std::pair<BUSData, Roaring>> newB;
+  ReadECCache ec_cache;
 
   void operator()();
   void processBuffer();
@@ -416,9 +578,8 @@ public:
   AlnProcessor(const KmerIndex& index, const ProgramOptions& opt, MasterProcessor& mp, const EMAlgorithm& em, const Transcriptome& model, bool useEM, int id = -1);
   AlnProcessor(AlnProcessor && o);
   ~AlnProcessor();
-  char *buffer;
+  ReadBatch batch;
   char *bambuffer;
-  size_t bufsize;
   size_t bambufsize;
   bool paired;
   std::vector<std::pair<int, std::string>> ec_umi;
@@ -432,14 +593,6 @@ public:
   const Transcriptome& model;
   bool useEM;
 
-
-
-  std::vector<std::pair<const char*, int>> seqs;
-  std::vector<std::pair<const char*, int>> names;
-  std::vector<std::pair<const char*, int>> quals;
-  std::vector<uint32_t> flags;
-  std::vector<std::string> umis;
-
   void operator()();
   void processBufferTrans();
   void processBufferGenome();
@@ -0,0 +1,189 @@
+#ifndef KALLISTO_SMALL_EC_HPP
+#define KALLISTO_SMALL_EC_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+#include "roaring.hh"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KALLISTO_SMALL_EC_X86
+#endif
+
+// A set of at most SmallEC::capacity target ids, kept sorted in an inline
+// array. Most ECs seen at read time are this small, and operating on them
+// here needs no allocation, unlike a Roaring bitmap. Callers load an EC
+// with assign() and fall back to Roaring when it does not fit. Building
+// a Roaring bitmap back is the expensive part, so the callers avoid it
+// when the result is one of the input sets.
+//
+// Slots past size() always hold NO_ID, so the kernels can compare against
+// the whole array at once without looking at the size.
+class SmallEC {
+public:
+  static const size_t capacity = 32;
+  static const uint32_t NO_ID = 0xFFFFFFFF;
+
+  SmallEC() : n(0) {
+    pad(0);
+  }
+
+  // false, leaving the set unchanged, if r does not fit
+  bool assign(const Roaring& r) {
+    if (r.cardinality() > capacity) {
+      return false;
+    }
+    size_t old = n;
+    r.toUint32Array(ids);
+    n = r.cardinality();
+    pad(n, old);
+    return true;
+  }
+
+  void intersect(const SmallEC& o) {
+    size_t old = n;
+    n = intersectKernel()(ids, n, o.ids, ids);
+    pad(n, old);
+  }
+
+  // keeps the ids that are also in r
+  void intersect(const Roaring& r) {
+    filter([&](uint32_t id) { return r.contains(id); });
+  }
+
+  // keeps the ids for which keep(id) is true
+  template <class Pred>
+  void filter(Pred keep) {
+    size_t old = n, j = 0;
+    for (size_t i = 0; i < old; i++) {
+      ids[j] = ids[i];
+      j += keep(ids[i]) ? 1 : 0;
+    }
+    n = j;
+    pad(n, old);
+  }
+
+  size_t size() const {
+    return n;
+  }
+
+  bool empty() const {
+    return n == 0;
+  }
+
+  uint32_t operator[](size_t i) const {
+    return ids[i];
+  }
+
+  const uint32_t* begin() const {
+    return ids;
+  }
+
+  const uint32_t* end() const {
+    return ids + n;
+  }
+
+  void toRoaring(Roaring& r) const {
+    r = Roaring(n, ids);
+  }
+
+  // u &= r, without building a new bitmap when u fits and loses nothing
+  static void mask(Roaring& u, const Roaring& r) {
+    SmallEC small;
+    if (!small.assign(u)) {
+      u &= r;
+      return;
+    }
+    size_t n = small.size();
+    small.intersect(r);
+    if (small.size() != n) {
+      small.toRoaring(u);
+    }
+  }
+
+  // Intersects the sorted, distinct ids a[0..na) with b, which holds
+  // capacity slots padded with NO_ID, into out. out may be a.
+  typedef size_t (*Kernel)(const uint32_t* a, size_t na, const uint32_t* b, uint32_t* out);
+
+  static size_t intersectScalar(const uint32_t* a, size_t na, const uint32_t* b, uint32_t* out) {
+    size_t i = 0, j = 0, k = 0;
+    while (i < na && b[j] != NO_ID) {
+      if (a[i] < b[j]) {
+        i++;
+      } else if (b[j] < a[i]) {
+        j++;
+      } else {
+        out[k++] = a[i];
+        i++;
+        j++;
+      }
+    }
+    return k;
+  }
+
+#ifdef KALLISTO_SMALL_EC_X86
+  // Each id of a is compared against all of b at once, so there is no
+  // data dependent branch. SSE2 is part of x86-64, AVX2 is picked at run
+  // time.
+  static size_t intersectSSE2(const uint32_t* a, size_t na, const uint32_t* b, uint32_t* out) {
+    __m128i vb[capacity/4];
+    for (size_t j = 0; j < capacity/4; j++) {
+      vb[j] = _mm_loadu_si128((const __m128i*) (b + 4*j));
+    }
+    size_t k = 0;
+    for (size_t i = 0; i < na; i++) {
+      __m128i x = _mm_set1_epi32(a[i]);
+      __m128i eq = _mm_cmpeq_epi32(x, vb[0]);
+      for (size_t j = 1; j < capacity/4; j++) {
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi32(x, vb[j]));
+      }
+      out[k] = a[i];
+      k += (_mm_movemask_epi8(eq) != 0) ? 1 : 0;
+    }
+    return k;
+  }
+
+  __attribute__((target("avx2")))
+  static size_t intersectAVX2(const uint32_t* a, size_t na, const uint32_t* b, uint32_t* out) {
+    __m256i vb[capacity/8];
+    for (size_t j = 0; j < capacity/8; j++) {
+      vb[j] = _mm256_loadu_si256((const __m256i*) (b + 8*j));
+    }
+    size_t k = 0;
+    for (size_t i = 0; i < na; i++) {
+      __m256i x = _mm256_set1_epi32(a[i]);
+      __m256i eq = _mm256_cmpeq_epi32(x, vb[0]);
+      for (size_t j = 1; j < capacity/8; j++) {
+        eq = _mm256_or_si256(eq, _mm256_cmpeq_epi32(x, vb[j]));
+      }
+      out[k] = a[i];
+      k += _mm256_testz_si256(eq, eq) ? 0 : 1;
+    }
+    return k;
+  }
+#endif
+
+  // the fastest kernel this CPU supports
+  static Kernel intersectKernel() {
+#ifdef KALLISTO_SMALL_EC_X86
+    static const Kernel kernel = __builtin_cpu_supports("avx2") ? intersectAVX2 : intersectSSE2;
+    return kernel;
+#else
+    return intersectScalar;
+#endif
+  }
+
+private:
+  // refills [from, to) with NO_ID, to is where the padding started before
+  void pad(size_t from, size_t to = capacity) {
+    for (size_t i = from; i < to; i++) {
+      ids[i] = NO_ID;
+    }
+  }
+
+  alignas(32) uint32_t ids[capacity];
+  size_t n;
+};
+
+#endif // KALLISTO_SMALL_EC_HPP
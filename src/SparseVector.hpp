@@ -19,15 +19,20 @@ public:
   void clear();
   
   const Roaring& getIndices() const; // Get all transcript IDs stored in this object	
+  // Id of the transcript set in the index-wide dictionary (see KmerIndex::internBlockECs), or NO_SET_ID
+  uint32_t getSetId() const;
+  void setSetId(uint32_t id);
   // Populates elems with (index, element) tuples
   void getElements(std::vector<std::pair<uint32_t, Roaring> > &elems) const;
   Roaring get(size_t i, bool getOne=false) const;
+  uint32_t getFirst(size_t i) const; // get(i, true).minimum() without building a Roaring
   bool contains(size_t i) const; // Whether the transcript with id i exists in this object
   bool isEmpty() const;
   
   SparseVector<T>& operator=(SparseVector<T> &&other);
   SparseVector<T>& operator=(const SparseVector<T> &other);
-  // checks if r is equal between two objects (only r is considered, nothing else):
+  // checks if r is equal between two objects (only r is considered, nothing else);
+  // an integer compare when both sets have been interned:
   bool operator==(const SparseVector<T>& other) const;
   char operator[] (size_t i); // Returns strandedness: (pos & 0x7FFFFFFF) == pos, for transcript id: i; could also return 2 if ambiguous (e.g. for tx i, a + part and a - part exist in this block)
   const char operator[] (size_t i) const;
@@ -38,10 +43,13 @@ public:
   
   void runOptimize();
   size_t cardinality() const;
+
+  static const uint32_t NO_SET_ID = 0xFFFFFFFF;
   
 private:
   Roaring r; // Set of transcripts in this data structure {tx A, tx B, tx C, ...}
   uint8_t flag; // How the storage should work see below:
+  uint32_t set_id; // Interned id of r (fits in the padding after flag)
   // flag=0 means uninitialized / low-memory / no member in the union activated
   // flag=1 means store strand+positional info in posinfo struct (high memory)
   // flag=2 means store strand info in a char array and don't store positional info
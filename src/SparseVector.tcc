@@ -2,6 +2,7 @@ template <class T>
 SparseVector<T>::SparseVector(bool init) {
   r = Roaring();
   flag = 0;
+  set_id = NO_SET_ID;
   if (init) { // Initialize it for insertion/serialization purposes
     flag = 4;
     new (&v) std::vector<Roaring>*;
@@ -67,6 +68,7 @@ SparseVector<T>::SparseVector(SparseVector<T> &&arg) {
     break;
   }
   r = std::move(arg.r);
+  set_id = arg.set_id;
 };
 
 template <class T>
@@ -111,6 +113,7 @@ SparseVector<T>::SparseVector(const SparseVector<T> &arg) {
     }
   }
   r = arg.r;
+  set_id = arg.set_id;
 };
 
 template <class T>
@@ -144,6 +147,7 @@ SparseVector<T>& SparseVector<T>::operator=(SparseVector<T> &&other) {
     break;
   }
   r = std::move(other.r);
+  set_id = other.set_id;
   return *this;
 }
 
@@ -199,6 +203,7 @@ SparseVector<T>& SparseVector<T>::operator=(const SparseVector<T> &other) {
     break;
   }
   r = other.r;
+  set_id = other.set_id;
   return *this;
 }
 
@@ -221,6 +226,7 @@ void SparseVector<T>::insert(size_t i, const T &elem) {
   } else {
     idx = r.rank(i);
     r.add(i);
+    set_id = NO_SET_ID;
     Roaring new_elem;
     new_elem.add(elem);
     if (v->size() == idx) {
@@ -249,6 +255,7 @@ Roaring SparseVector<T>::remove(size_t i) {
     size_t idx = r.rank(i) - 1;
     t = (*v)[idx];
     r.remove(i);
+    set_id = NO_SET_ID;
     v->erase(v->begin()+idx);
   }
   return t;
@@ -277,6 +284,7 @@ void SparseVector<T>::clear() {
   }
   r = Roaring();
   flag = 0;
+  set_id = NO_SET_ID;
 }
 
 template <class T>
@@ -284,6 +292,16 @@ const Roaring& SparseVector<T>::getIndices() const {
   return r;
 }
 
+template <class T>
+uint32_t SparseVector<T>::getSetId() const {
+  return set_id;
+}
+
+template <class T>
+void SparseVector<T>::setSetId(uint32_t id) {
+  set_id = id;
+}
+
 template <class T>
 void SparseVector<T>::getElements(std::vector<std::pair<uint32_t, Roaring> > &elems) const {
   if (flag != 4) {
@@ -323,6 +341,23 @@ Roaring SparseVector<T>::get(size_t i, bool getOne) const {
   throw std::invalid_argument("Index not present in SparseVector.");
 }
 
+template <class T>
+uint32_t SparseVector<T>::getFirst(size_t i) const {
+  if (!(flag == 1)) {
+    throw std::runtime_error("Invalid call to getFirst() in SparseVector.");
+  }
+  if (r.contains(i)) {
+    i = r.rank(i)-1;
+    if ((arr.v[i] | 0x40000000) == arr.v[i]) { // Second MSB is 1
+      uint32_t offset = arr.v[i] & ~(0x60000000); // Mask out second and third MSB
+      return (arr.a[offset] > 0) ? arr.a[offset+1] : 0xFFFFFFFF; // minimum() of an empty Roaring
+    } else { // Second MSB is 0
+      return arr.v[i] & ~(0x60000000); // Mask out second and third MSB
+    }
+  }
+  throw std::invalid_argument("Index not present in SparseVector.");
+}
+
 template <class T>
 bool SparseVector<T>::contains(size_t i) const {
   return r.contains(i);
@@ -390,6 +425,9 @@ const char SparseVector<T>::operator[] (size_t i) const {
 
 template <class T>
 bool SparseVector<T>::operator==(const SparseVector<T>& other) const {
+  if (set_id != NO_SET_ID && other.set_id != NO_SET_ID) {
+    return set_id == other.set_id;
+  }
   return r == other.r; 
 }
 
@@ -431,6 +469,7 @@ void SparseVector<T>::deserialize(std::istream& in, bool small) {
   char* buffer = new char[tmp_size];
   in.read(buffer, tmp_size);
   r = Roaring::read(buffer, false);
+  set_id = NO_SET_ID;
   delete[] buffer;
   size_t v_size;
   in.read((char *)&v_size, sizeof(v_size)); // Number of elements (aka number of transcripts in set)
@@ -91,6 +91,7 @@ struct ProgramOptions {
   bool verbose;
   bool aa;
   bool distinguish;
+  bool bloom_filter;
   int threads;
   std::string index;
   int k;
@@ -99,6 +100,10 @@ struct ProgramOptions {
   int iterations;
   std::string output;
   int skip;
+  bool unitig_match;
+  bool early_exit;
+  size_t ec_memo_size;
+  size_t ec_cache_size;
   size_t seed;
   double fld;
   double sd;
@@ -132,7 +137,10 @@ struct ProgramOptions {
   StrandType strand;
   std::string gfa; // used for inspect
   bool inspect_thorough;
+  size_t gzindex_span; // uncompressed bytes between access points, for gzindex
   bool single_overhang;
+  bool squarem;
+  bool em_components;
   bool record_batch_bus_barcode;
   bool matrix_to_files;
   bool matrix_to_directories;
@@ -150,12 +158,19 @@ struct ProgramOptions {
 
 ProgramOptions() :
   verbose(false),
+  aa(false),
+  distinguish(false),
+  bloom_filter(false),
   threads(1),
   k(31),
   g(0),
   max_ec_size(0),
   iterations(500),
   skip(1),
+  unitig_match(false),
+  early_exit(false),
+  ec_memo_size(1ULL<<16),
+  ec_cache_size(1ULL<<14),
   seed(42),
   fld(0.0),
   sd(0.0),
@@ -184,9 +199,10 @@ ProgramOptions() :
   dfk_onlist(false),
   strand(StrandType::None),
   inspect_thorough(false),
+  gzindex_span(1ULL<<24),
   single_overhang(false),
-  aa(false),
-  distinguish(false)
+  squarem(false),
+  em_components(false)
   {}
 };
 
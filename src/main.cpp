@@ -23,6 +23,7 @@
 #include "H5Writer.h"
 #include "PlaintextWriter.h"
 #include "GeneModel.h"
+#include "ParallelGzip.h"
 #include <CompactedDBG.hpp>
 
 //#define ERROR_STR "\033[1mError:\033[0m"
@@ -51,6 +52,7 @@ void ParseOptionsIndex(int argc, char **argv, ProgramOptions& opt) {
   int aa_flag = 0;
   int distinguish_flag = 0;
   int skip_index_flag = 0;
+  int bloom_filter_flag = 0;
   const char *opt_string = "i:k:m:e:t:d:";
   static struct option long_options[] = {
     // long args
@@ -59,6 +61,7 @@ void ParseOptionsIndex(int argc, char **argv, ProgramOptions& opt) {
     {"aa", no_argument, &aa_flag, 1},
     {"skip-index", no_argument, &skip_index_flag, 1},
     {"distinguish", no_argument, &distinguish_flag, 1},
+    {"bloom-filter", no_argument, &bloom_filter_flag, 1},
     // short args
     {"index", required_argument, 0, 'i'},
     {"kmer-size", required_argument, 0, 'k'},
@@ -126,6 +129,9 @@ void ParseOptionsIndex(int argc, char **argv, ProgramOptions& opt) {
   if (distinguish_flag) {
     opt.distinguish = true;
   }
+  if (bloom_filter_flag) {
+    opt.bloom_filter = true;
+  }
 
   for (int i = optind; i < argc; i++) {
     opt.transfasta.push_back(argv[i]);
@@ -186,6 +192,43 @@ void ParseOptionsInspect(int argc, char **argv, ProgramOptions& opt) {
   }
 }
 
+void ParseOptionsGzindex(int argc, char **argv, ProgramOptions& opt) {
+
+  const char *opt_string = "s:";
+
+  static struct option long_options[] = {
+    // long args
+    {"span", required_argument, 0, 's'},
+    {0,0,0,0}
+  };
+
+  int c;
+  int option_index = 0;
+  while (true) {
+    c = getopt_long(argc,argv,opt_string, long_options, &option_index);
+
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+    case 0:
+      break;
+    case 's': {
+      double mb = 0;
+      stringstream(optarg) >> mb;
+      opt.gzindex_span = (mb > 0) ? (size_t) (mb * (1ULL<<20)) : 0;
+      break;
+    }
+    default: break;
+    }
+  }
+
+  for (int i = optind; i < argc; i++) {
+    opt.files.push_back(argv[i]);
+  }
+}
+
 void ParseOptionsEM(int argc, char **argv, ProgramOptions& opt) {
   int verbose_flag = 0;
   int plaintext_flag = 0;
@@ -199,6 +242,10 @@ void ParseOptionsEM(int argc, char **argv, ProgramOptions& opt) {
   int pbam_flag = 0;
   int gbam_flag = 0;
   int fusion_flag = 0;
+  int squarem_flag = 0;
+  int em_components_flag = 0;
+  int unitig_match_flag = 0;
+  int early_exit_flag = 0;
 
   const char *opt_string = "t:i:l:s:o:n:m:d:b:g:c:";
   static struct option long_options[] = {
@@ -215,7 +262,13 @@ void ParseOptionsEM(int argc, char **argv, ProgramOptions& opt) {
     {"pseudobam", no_argument, &pbam_flag, 1},
     {"genomebam", no_argument, &gbam_flag, 1},
     {"fusion", no_argument, &fusion_flag, 1},
+    {"squarem", no_argument, &squarem_flag, 1},
+    {"em-components", no_argument, &em_components_flag, 1},
+    {"unitig-match", no_argument, &unitig_match_flag, 1},
+    {"early-exit", no_argument, &early_exit_flag, 1},
     {"seed", required_argument, 0, 'd'},
+    {"ec-memo-size", required_argument, 0, 'e'},
+    {"ec-cache-size", required_argument, 0, 'E'},
     // short args
     {"threads", required_argument, 0, 't'},
     {"index", required_argument, 0, 'i'},
@@ -284,6 +337,14 @@ void ParseOptionsEM(int argc, char **argv, ProgramOptions& opt) {
       stringstream(optarg) >> opt.seed;
       break;
     }
+    case 'e': {
+      stringstream(optarg) >> opt.ec_memo_size;
+      break;
+    }
+    case 'E': {
+      stringstream(optarg) >> opt.ec_cache_size;
+      break;
+    }
 
     default: break;
     }
@@ -318,6 +379,14 @@ void ParseOptionsEM(int argc, char **argv, ProgramOptions& opt) {
     opt.single_overhang = true;
   }
 
+  if (unitig_match_flag) {
+    opt.unitig_match = true;
+  }
+
+  if (early_exit_flag) {
+    opt.early_exit = true;
+  }
+
   if (strand_FR_flag) {
     opt.strand_specific = true;
     opt.strand = ProgramOptions::StrandType::FR;
@@ -344,6 +413,14 @@ void ParseOptionsEM(int argc, char **argv, ProgramOptions& opt) {
   if (fusion_flag) {
     opt.fusion = true;
   }
+
+  if (squarem_flag) {
+    opt.squarem = true;
+  }
+
+  if (em_components_flag) {
+    opt.em_components = true;
+  }
 }
 
 void ParseOptionsTCCQuant(int argc, char **argv, ProgramOptions& opt) {
@@ -351,8 +428,12 @@ void ParseOptionsTCCQuant(int argc, char **argv, ProgramOptions& opt) {
   int matrix_to_files = 0;
   int matrix_to_directories = 0;
   int plaintext_flag = 0;
+  int squarem_flag = 0;
+  int em_components_flag = 0;
   static struct option long_options[] = {
     {"plaintext", no_argument, &plaintext_flag, 1},
+    {"squarem", no_argument, &squarem_flag, 1},
+    {"em-components", no_argument, &em_components_flag, 1},
     {"matrix-to-files", no_argument, &matrix_to_files, 1},
     {"matrix-to-directories", no_argument, &matrix_to_directories, 1},
     {"index", required_argument, 0, 'i'},
@@ -443,6 +524,12 @@ void ParseOptionsTCCQuant(int argc, char **argv, ProgramOptions& opt) {
   if (plaintext_flag) {
     opt.plaintext = true;
   }
+  if (squarem_flag) {
+    opt.squarem = true;
+  }
+  if (em_components_flag) {
+    opt.em_components = true;
+  }
   for (int i = optind; i < argc; i++) {
     opt.files.push_back(argv[i]);
   }
@@ -487,6 +574,8 @@ void ParseOptionsBus(int argc, char **argv, ProgramOptions& opt) {
   int interleaved_flag = 0;
   int batch_barcodes_flag = 0;
   int dfk_onlist_flag = 0;
+  int unitig_match_flag = 0;
+  int early_exit_flag = 0;
 
   const char *opt_string = "i:o:x:t:lbng:c:T:B:N:";
   static struct option long_options[] = {
@@ -513,6 +602,10 @@ void ParseOptionsBus(int argc, char **argv, ProgramOptions& opt) {
     {"inleaved", no_argument, &interleaved_flag, 1},
     {"numReads", required_argument, 0, 'N'},
     {"batch-barcodes", no_argument, &batch_barcodes_flag, 1},
+    {"unitig-match", no_argument, &unitig_match_flag, 1},
+    {"early-exit", no_argument, &early_exit_flag, 1},
+    {"ec-memo-size", required_argument, 0, 'e'},
+    {"ec-cache-size", required_argument, 0, 'E'},
     {0,0,0,0}
   };
 
@@ -582,6 +675,14 @@ void ParseOptionsBus(int argc, char **argv, ProgramOptions& opt) {
       stringstream(optarg) >> opt.tagsequence;
       break;
     }
+    case 'e': {
+      stringstream(optarg) >> opt.ec_memo_size;
+      break;
+    }
+    case 'E': {
+      stringstream(optarg) >> opt.ec_cache_size;
+      break;
+    }
     default: break;
     }
   }
@@ -595,6 +696,14 @@ void ParseOptionsBus(int argc, char **argv, ProgramOptions& opt) {
     opt.verbose = true;
   }
 
+  if (unitig_match_flag) {
+    opt.unitig_match = true;
+  }
+
+  if (early_exit_flag) {
+    opt.early_exit = true;
+  }
+
   if (gbam_flag) {
     opt.pseudobam = true;
     opt.genomebam = true;
@@ -1779,6 +1888,32 @@ bool CheckOptionsTCCQuant(ProgramOptions& opt) {
    return ret;
 }
 
+bool CheckOptionsGzindex(ProgramOptions& opt) {
+
+  bool ret = true;
+
+  if (opt.gzindex_span == 0) {
+    cerr << "Error: invalid span" << endl;
+    ret = false;
+  }
+
+  if (opt.files.empty()) {
+    cerr << "Error: missing gzip files" << endl;
+    ret = false;
+  } else {
+    struct stat stFileInfo;
+    for (auto& fn : opt.files) {
+      auto intStat = stat(fn.c_str(), &stFileInfo);
+      if (intStat != 0) {
+        cerr << "Error: file not found " << fn << endl;
+        ret = false;
+      }
+    }
+  }
+
+  return ret;
+}
+
 bool CheckOptionsInspect(ProgramOptions& opt) {
 
   bool ret = true;
@@ -1907,6 +2042,7 @@ void usage() {
        << "    bus           Generate BUS files for single-cell data " << endl
        << "    h5dump        Converts HDF5-formatted results to plaintext" << endl
        << "    inspect       Inspects and gives information about an index" << endl
+       << "    gzindex       Indexes gzip files so they can be read in parallel" << endl
        << "    version       Prints version information" << endl
        << "    cite          Prints citation information" << endl << endl
        << "Running kallisto <CMD> without arguments prints usage information for <CMD>"<< endl << endl;
@@ -1937,6 +2073,14 @@ void usageBus() {
        << "    --aa                      Align to index generated from a FASTA-file containing amino acid sequences" << endl
        << "    --inleaved                Specifies that input is an interleaved FASTQ file" << endl
        << "    --batch-barcodes          Records both batch and extracted barcode in BUS file" << endl
+       << "    --unitig-match            Match reads one unitig at a time instead of jumping" << endl
+       << "                              k-mer by k-mer (fewer k-mer lookups)" << endl
+       << "    --early-exit              Stop matching a read once it is down to one target" << endl
+       << "                              or none (faster, may rarely differ)" << endl
+       << "    --ec-memo-size=INT        Number of EC intersections each thread remembers," << endl
+       << "                              0 to disable (default: 65536)" << endl
+       << "    --ec-cache-size=INT       Number of reads each thread remembers the EC of," << endl
+       << "                              0 to disable (default: 16384)" << endl
        << "    --verbose                 Print out progress information every 1M proccessed reads" << endl;
 }
 
@@ -1953,6 +2097,8 @@ void usageIndex() {
        << "    --make-unique           Replace repeated target names with unique names" << endl
        << "    --aa                    Generate index from a FASTA-file containing amino acid sequences" << endl
        << "    --distinguish           Generate index where sequences are distinguished by the sequence name" << endl
+       << "    --bloom-filter          Store a Bloom filter of the k-mers so that reads with no k-mer" << endl
+       << "                            in the index are rejected before the index lookups" << endl
        << "-t, --threads=INT           Number of threads to use (default: 1)" << endl
        << "-m, --min-size=INT          Length of minimizers (default: automatically chosen)" << endl
        << "-e, --ec-max-size=INT       Maximum number of targets in an equivalence class (default: automatically chosen)" << endl
@@ -1975,6 +2121,16 @@ void usageInspect() {
        << "-t                      Number of threads" << endl << endl;
 }
 
+void usageGzindex() {
+  cout << "kallisto " << KALLISTO_VERSION << endl
+       << "Indexes gzip-compressed FASTQ files so that quant and bus can inflate" << endl
+       << "them on several threads; the index of FILE is written to FILE.kzi" << endl << endl
+       << "Usage: kallisto gzindex [arguments] FASTQ-files" << endl << endl
+       << "Optional arguments:" << endl
+       << "-s, --span=DOUBLE             Megabytes of uncompressed data between access" << endl
+       << "                              points (default: 16)" << endl << endl;
+}
+
 void usageEM(bool valid_input = true) {
   if (valid_input) {
 
@@ -2002,6 +2158,17 @@ void usageEM(bool valid_input = true) {
        << "                              (default: -l, -s values are estimated from paired" << endl
        << "                               end data, but are required when using --single)" << endl
        << "-t, --threads=INT             Number of threads to use (default: 1)" << endl
+       << "    --squarem                 Use SQUAREM-accelerated EM (fewer rounds to converge)" << endl
+       << "    --em-components           Run the EM separately on each connected component of" << endl
+       << "                              the transcript/equivalence class graph" << endl
+       << "    --unitig-match            Match reads one unitig at a time instead of jumping" << endl
+       << "                              k-mer by k-mer (fewer k-mer lookups)" << endl
+       << "    --early-exit              Stop matching a read once it is down to one target" << endl
+       << "                              or none (faster, may rarely differ)" << endl
+       << "    --ec-memo-size=INT        Number of EC intersections each thread remembers," << endl
+       << "                              0 to disable (default: 65536)" << endl
+       << "    --ec-cache-size=INT       Number of reads each thread remembers the EC of," << endl
+       << "                              0 to disable (default: 16384)" << endl
        << "    --verbose                 Print out progress information every 1M proccessed reads" << endl;
 
 }
@@ -2051,6 +2218,9 @@ void usageTCCQuant(bool valid_input = true) {
        << "    --matrix-to-files         Reorganize matrix output into abundance tsv files" << endl
        << "    --matrix-to-directories   Reorganize matrix output into abundance tsv files across multiple directories" << endl
        << "    --seed=INT                Seed for the bootstrap sampling (default: 42)" << endl
+       << "    --squarem                 Use SQUAREM-accelerated EM (fewer rounds to converge)" << endl
+       << "    --em-components           Run the EM separately on each connected component of" << endl
+       << "                              the transcript/equivalence class graph" << endl
        << "    --plaintext               Output plaintext only, not HDF5" << endl;
 }
 
@@ -2112,6 +2282,7 @@ int main(int argc, char *argv[]) {
         out.open(opt.index, std::ios::out | std::ios::binary);
         if (opt.distinguish) index.BuildDistinguishingGraph(opt, out);
         else index.BuildTranscripts(opt, out);
+        if (opt.bloom_filter) index.buildKmerFilter();
         index.write(out, opt.threads);
 
       }
@@ -2130,6 +2301,21 @@ int main(int argc, char *argv[]) {
         index.load(opt);
         InspectIndex(index,opt);
       }
+    } else if (cmd == "gzindex") {
+      if (argc==2) {
+        usageGzindex();
+        return 0;
+      }
+      ParseOptionsGzindex(argc-1, argv+1, opt);
+      if (!CheckOptionsGzindex(opt)) {
+        usageGzindex();
+        exit(1);
+      }
+      for (auto& fn : opt.files) {
+        if (!ParallelGzip::buildIndex(fn, opt.gzindex_span)) {
+          exit(1);
+        }
+      }
     } else if (cmd == "bus") {
       if (argc ==2) {
         usageBus();
@@ -2332,7 +2518,10 @@ int main(int argc, char *argv[]) {
         std::string(std::to_string(index.INDEX_VERSION)),
         start_time,
         call,
-        opt.aa ? std::to_string(collection.cardinality_clashes) : "");
+        opt.aa ? std::to_string(collection.cardinality_clashes) : "",
+        "",
+        std::to_string(MP.ec_cache_hits),
+        std::to_string(MP.ec_cache_misses));
       
       if (opt.pseudobam) {
         std::vector<double> fl_means(index.target_lens_.size(),0.0);
@@ -2466,7 +2655,10 @@ int main(int argc, char *argv[]) {
             std::string(std::to_string(index.INDEX_VERSION)),
             start_time,
             call,
-            opt.aa ? std::to_string(collection.cardinality_clashes) : "");
+            opt.aa ? std::to_string(collection.cardinality_clashes) : "",
+            std::to_string(em.num_rounds_),
+            std::to_string(MP.ec_cache_hits),
+            std::to_string(MP.ec_cache_misses));
 
         plaintext_writer(opt.output + "/abundance.tsv", em.target_names_,
             em.alpha_, em.eff_lens_, index.target_lens_);
@@ -2505,11 +2697,11 @@ int main(int argc, char *argv[]) {
             }
             #ifdef USE_HDF5
             BootstrapThreadPool pool(opt.threads, seeds, collection.counts, index,
-                collection, em.eff_lens_, opt, &writer, fl_means);
+                em, opt, &writer);
             #endif
           } else {
             for (auto b = 0; b < B; ++b) {
-              Bootstrap bs(collection.counts, index, collection, em.eff_lens_, seeds[b], fl_means, opt);
+              Bootstrap bs(collection.counts, em, seeds[b], opt, opt.threads);
               cerr << "[bstrp] running EM for the bootstrap: " << b + 1 << "\r";
               auto res = bs.run_em();
 
@@ -2720,6 +2912,10 @@ int main(int argc, char *argv[]) {
         const bool gene_level_counting = !opt.genemap.empty() || !opt.gtfFile.empty();
 
         std::cerr << "[quant] Running EM algorithm..."; std::cerr.flush();
+        // samples are already run in parallel, only hand the EM itself the
+        // threads that are left over
+        const int em_threads = std::max(1, opt.threads / std::max(1, (int) nrow));
+        std::vector<size_t> em_rounds(nrow, 0);
         auto EM_lambda = [&](int id) {
           std::cerr << "[quant] Processing sample/cell " << std::to_string(id) << std::endl;
           MinCollector collection(index, opt);
@@ -2751,7 +2947,9 @@ int main(int argc, char *argv[]) {
           }
 
           EMAlgorithm em(collection.counts, index, collection, fl_means, opt);
+          em.set_num_threads(em_threads);
           em.run(10000, 50, false, false);
+          em_rounds[id] = em.num_rounds_;
 
           if (isMatrixFile) { // Update abundances matrix
             auto &ab_m = Abundance_mat[id];
@@ -2865,7 +3063,7 @@ int main(int argc, char *argv[]) {
                     seeds.push_back( rand() );
                   }
                   for (auto b = 0; b < B; ++b) {
-                    Bootstrap bs(collection.counts, index, collection, em.eff_lens_, seeds[b], fl_means, opt);
+                    Bootstrap bs(collection.counts, em, seeds[b], opt, em_threads);
                     auto res = bs.run_em();
                     if (!opt.plaintext) {
 #ifdef USE_HDF5
@@ -2902,7 +3100,7 @@ int main(int argc, char *argv[]) {
             }
             cerr << endl;
             for (auto b = 0; b < B; ++b) {
-              Bootstrap bs(collection.counts, index, collection, em.eff_lens_, seeds[b], fl_means, opt);
+              Bootstrap bs(collection.counts, em, seeds[b], opt, em_threads);
               cerr << "[bstrp] running EM for the bootstrap: " << b + 1 << "\r";
               auto res = bs.run_em();
               plaintext_writer(opt.output + "/bs_abundance_" + std::to_string(b) + ".tsv",
@@ -2950,6 +3148,36 @@ int main(int argc, char *argv[]) {
           }
           translens_f.close();
         }
+
+        // every TCC is pseudoaligned; over all samples, with the most EM
+        // rounds any of them took
+        std::vector<bool> unique_ec(index.ecmapinv.size(), false);
+        for (const auto& elem : index.ecmapinv) {
+          unique_ec[elem.second] = elem.first.cardinality() == 1;
+        }
+        uint64_t num_pseudoaligned = 0, num_unique = 0;
+        for (const auto& bc : batchCounts) {
+          for (const auto& p : bc) {
+            num_pseudoaligned += p.second;
+            if (p.first < unique_ec.size() && unique_ec[p.first]) {
+              num_unique += p.second;
+            }
+          }
+        }
+        std::string call = argv_to_string(argc, argv);
+        plaintext_aux(
+            opt.output + "/run_info.json",
+            std::string(std::to_string(index.onlist_sequences.cardinality())),
+            std::string(std::to_string(opt.bootstrap)),
+            std::string(std::to_string(num_pseudoaligned)),
+            std::string(std::to_string(num_pseudoaligned)),
+            std::string(std::to_string(num_unique)),
+            KALLISTO_VERSION,
+            std::string(std::to_string(index.INDEX_VERSION)),
+            start_time,
+            call,
+            "",
+            std::to_string(em_rounds.empty() ? 0 : *std::max_element(em_rounds.begin(), em_rounds.end())));
       }
     } else if (cmd == "pseudo") {
       cerr << "Deprecated: `kallisto pseudo` is deprecated. See `kallisto bus`." << endl;
@@ -230,7 +230,7 @@ WeightMap calc_weights(
   WeightMap weights(ecmapinv.size());
 
   for (const auto& it : ecmapinv) {
-    auto& v = it.first;
+    auto& v = it.first.ec;
 
     std::vector<double> trans_weights;
     trans_weights.reserve(v.cardinality());
@@ -245,6 +245,41 @@ WeightMap calc_weights(
   return weights;
 }
 
+ECArena::ECArena(const EcMapInv& ecmapinv) {
+  size_t n = ecmapinv.size();
+  std::vector<size_t> card(n, 0);
+  for (const auto& it : ecmapinv) {
+    card[it.second] = it.first.cardinality();
+  }
+
+  offsets.assign(n+1, 0);
+  for (size_t i = 0; i < n; ++i) {
+    offsets[i+1] = offsets[i] + card[i];
+  }
+
+  trs.resize(offsets[n]);
+  for (const auto& it : ecmapinv) {
+    it.first.ec.toUint32Array(trs.data() + offsets[it.second]);
+  }
+}
+
+std::vector<double> calc_weights(
+  const std::vector<uint32_t>& counts,
+  const ECArena& arena,
+  const std::vector<double>& eff_lens)
+{
+  std::vector<double> weights(arena.trs.size());
+
+  for (size_t ec = 0; ec < arena.size(); ++ec) {
+    double c = static_cast<double>(counts[ec]);
+    for (size_t j = arena.offsets[ec]; j < arena.offsets[ec+1]; ++j) {
+      weights[j] = c / eff_lens[arena.trs[j]];
+    }
+  }
+
+  return weights;
+}
+
 std::vector<double> trunc_gaussian_fld(int start, int stop, double mean,
     double sd) {
   size_t n = stop - start;
@@ -12,6 +12,21 @@ struct MinCollector;
 
 using WeightMap = std::vector<std::vector<double>>;
 
+// Equivalence classes flattened into one contiguous (CSR) arena, indexed by
+// EC id: the targets of EC i are trs[offsets[i]] .. trs[offsets[i+1]-1], in
+// increasing order. Built once per EM so the inner loop never walks the
+// ecmapinv hash map or decodes a Roaring bitmap.
+struct ECArena {
+  std::vector<size_t> offsets;
+  std::vector<uint32_t> trs;
+
+  ECArena() {}
+  ECArena(const EcMapInv& ecmapinv);
+
+  size_t size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+  size_t cardinality(size_t ec) const { return offsets[ec+1] - offsets[ec]; }
+};
+
 // this function takes the 'mean_fl_trunc' from MinCollector and simply gives
 // you back a 'mean fragment length' for every single transcript. this avoids
 // you having to check the length every single time
@@ -38,6 +53,12 @@ WeightMap calc_weights(
   const EcMapInv& ecmapinv,
   const std::vector<double>& eff_lens);
 
+// weights are stored flat, in the same order as arena.trs
+std::vector<double> calc_weights(
+  const std::vector<uint32_t>& counts,
+  const ECArena& arena,
+  const std::vector<double>& eff_lens);
+
 
 // truncated gaussian fragment length distribution
 //
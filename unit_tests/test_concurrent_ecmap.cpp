@@ -0,0 +1,99 @@
+#include "catch.hpp"
+
+#include <thread>
+#include <vector>
+
+#include "ConcurrentEcMap.hpp"
+
+TEST_CASE("concurrent ec map", "[ecmap]")
+{
+    // a tiny first table forces keys down the chain of grown tables
+    ConcurrentEcMap ecmap(4);
+    const int n_ecs = 4096;
+    const int n_threads = 8;
+
+    std::vector<Roaring> ecs(n_ecs);
+    for (int i = 0; i < n_ecs; ++i) {
+        ecs[i].add(i % 97);
+        ecs[i].add(100 + i);
+    }
+
+    // every thread inserts every ec, each in a different order (odd strides
+    // are coprime with n_ecs, so each visits them all)
+    std::vector<std::vector<int32_t>> ids(n_threads, std::vector<int32_t>(n_ecs));
+    std::vector<std::thread> workers;
+    for (int t = 0; t < n_threads; ++t) {
+        workers.emplace_back([&, t]() {
+            for (int j = 0; j < n_ecs; ++j) {
+                int i = (j * (2*t+1) + t) % n_ecs;
+                ids[t][i] = ecmap.insert(ecs[i]);
+            }
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+
+    REQUIRE(ecmap.size() == n_ecs);
+
+    auto by_id = ecmap.ecs();
+    REQUIRE(by_id.size() == n_ecs);
+    for (int i = 0; i < n_ecs; ++i) {
+        for (int t = 1; t < n_threads; ++t) {
+            REQUIRE(ids[t][i] == ids[0][i]);
+        }
+        REQUIRE(ecmap.find(ecs[i]) == ids[0][i]);
+        REQUIRE(by_id[ids[0][i]]->ec == ecs[i]);
+    }
+
+    Roaring absent;
+    absent.add(99);
+    REQUIRE(ecmap.find(absent) == -1);
+    REQUIRE(ecmap.insert(absent) == n_ecs);
+}
+
+TEST_CASE("concurrent ec map with adopted keys", "[ecmap]")
+{
+    std::vector<ECKey> known;
+    for (int i = 0; i < 1000; ++i) {
+        Roaring r;
+        r.add(i);
+        r.add(1000 + i % 7);
+        known.emplace_back(r);
+    }
+    ConcurrentEcMap ecmap(known.size());
+    for (size_t i = 0; i < known.size(); ++i) {
+        REQUIRE(ecmap.adopt(known[i]) == i);
+    }
+
+    // threads look up the adopted keys and add new ones alongside
+    const int n_threads = 4;
+    std::vector<std::thread> workers;
+    std::vector<std::vector<int32_t>> ids(n_threads, std::vector<int32_t>(known.size()));
+    std::vector<std::vector<int32_t>> known_ids(n_threads, std::vector<int32_t>(known.size()));
+    for (int t = 0; t < n_threads; ++t) {
+        workers.emplace_back([&, t]() {
+            for (size_t i = 0; i < known.size(); ++i) {
+                known_ids[t][i] = ecmap.insert(known[i].ec);
+                Roaring r(known[i].ec);
+                r.add(5000);
+                ids[t][i] = ecmap.insert(r);
+            }
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+
+    REQUIRE(ecmap.size() == 2*known.size());
+    auto by_id = ecmap.ecs();
+    for (size_t i = 0; i < known.size(); ++i) {
+        REQUIRE(by_id[i] == &known[i]);
+        REQUIRE(ids[0][i] >= known.size());
+        for (int t = 0; t < n_threads; ++t) {
+            REQUIRE(known_ids[t][i] == i);
+            REQUIRE(ids[t][i] == ids[0][i]);
+        }
+        REQUIRE(by_id[ids[0][i]]->ec.contains(5000));
+    }
+}
@@ -0,0 +1,191 @@
+#include "catch.hpp"
+
+#include "common.h"
+#include "FastqScanner.h"
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <zlib.h>
+
+namespace {
+
+std::string randomRecord(std::mt19937& gen, size_t i, size_t len) {
+    std::string seq(len, 'A'), qual(len, 'I');
+    for (size_t j = 0; j < len; j++) {
+        seq[j] = "ACGTN"[gen() % 5];
+        qual[j] = '!' + gen() % 40;
+    }
+    return "@read" + std::to_string(i) + " 1:N:0:" + std::to_string(i % 7) + "\n" + seq + "\n+\n" + qual + "\n";
+}
+
+void writeGz(const std::string& fn, const std::string& text) {
+    gzFile gz = gzopen(fn.c_str(), "wb");
+    gzwrite(gz, text.data(), text.size());
+    gzclose(gz);
+}
+
+}
+
+TEST_CASE("Newline kernels agree", "[fastq]")
+{
+    std::mt19937 gen(42);
+    std::string text(5000, 'A');
+    for (auto& c : text) {
+        c = (gen() % 8 == 0) ? '\n' : 'A';
+    }
+    std::vector<uint32_t> expected(text.size()), got(text.size());
+    for (size_t off : {0, 1, 7}) {
+        for (size_t n : {0, 1, 15, 16, 17, 31, 32, 33, 100, 4000}) {
+            size_t k = FastqScanner::newlinesScalar(text.data() + off, n, expected.data());
+            REQUIRE(FastqScanner::newlinesKernel()(text.data() + off, n, got.data()) == k);
+            REQUIRE(std::equal(expected.begin(), expected.begin() + k, got.begin()));
+#ifdef KALLISTO_FASTQ_SCANNER_X86
+            REQUIRE(FastqScanner::newlinesSSE2(text.data() + off, n, got.data()) == k);
+            REQUIRE(std::equal(expected.begin(), expected.begin() + k, got.begin()));
+            if (__builtin_cpu_supports("avx2")) {
+                REQUIRE(FastqScanner::newlinesAVX2(text.data() + off, n, got.data()) == k);
+                REQUIRE(std::equal(expected.begin(), expected.begin() + k, got.begin()));
+            }
+#endif
+        }
+    }
+}
+
+TEST_CASE("FASTQ scanner agrees with kseq", "[fastq]")
+{
+    std::mt19937 gen(42);
+    std::string text;
+    std::vector<uint64_t> offsets;
+    for (size_t i = 0; i < 300; i++) {
+        offsets.push_back(text.size());
+        // one record longer than the scanner's block
+        text += randomRecord(gen, i, (i == 100) ? 10000 : 50 + gen() % 100);
+    }
+    offsets.push_back(text.size());
+    text += "@wrapped\nACGT\nACGT\n+\nIIII\nIIII\n";
+    text += randomRecord(gen, 300, 80);
+    std::string fn = "tmp_scanner.fastq.gz";
+    writeGz(fn, text);
+
+    gzFile fp1 = gzopen(fn.c_str(), "r");
+    gzFile fp2 = gzopen(fn.c_str(), "r");
+    kseq_t *seq = kseq_init(fp1);
+    FastqScanner scanner(fp2, 4096);
+    FastqRecord r;
+    size_t n = 0;
+    while (true) {
+        int l = scanner.read(r);
+        int l_kseq = kseq_read(seq);
+        REQUIRE(scanner.begin() == offsets[n]);
+        if (n == 300) {
+            REQUIRE(l == -2); // left to kseq
+            break;
+        }
+        REQUIRE(l == l_kseq);
+        REQUIRE(std::string(r.seq, l) == seq->seq.s);
+        REQUIRE(std::string(r.qual, l) == seq->qual.s);
+        REQUIRE(std::string(r.name, r.name_len) == seq->name.s);
+        REQUIRE(std::string(r.comment, r.comment_len) == seq->comment.s);
+        n++;
+    }
+    kseq_destroy(seq);
+    gzclose(fp1);
+    gzclose(fp2);
+
+    // the end of a file is the end of the last record
+    writeGz(fn, text.substr(0, offsets[3]));
+    fp1 = gzopen(fn.c_str(), "r");
+    FastqScanner whole(fp1);
+    for (int i = 0; i < 3; i++) {
+        REQUIRE(whole.read(r) >= 0);
+    }
+    REQUIRE(whole.read(r) == -1);
+    gzclose(fp1);
+
+    // a last record without its newline is left to kseq
+    writeGz(fn, text.substr(0, offsets[3] - 1));
+    fp1 = gzopen(fn.c_str(), "r");
+    FastqScanner cut(fp1);
+    for (int i = 0; i < 2; i++) {
+        REQUIRE(cut.read(r) >= 0);
+    }
+    REQUIRE(cut.read(r) == -2);
+    // what kseq goes on with: the read-ahead, then the rest of the stream
+    std::string tail(cut.rest(), cut.restSize());
+    char c;
+    while (gzread(fp1, &c, 1) == 1) {
+        tail += c;
+    }
+    REQUIRE(tail == text.substr(offsets[2], offsets[3] - 1 - offsets[2]));
+    gzclose(fp1);
+
+    remove(fn.c_str());
+}
+
+// Seconds to read every record of fn with kseq and with the scanner; the
+// sequences read are checked against each other.
+static std::pair<double, double> timeReading(const std::string& fn)
+{
+    size_t n = 0, h = 0;
+    gzFile fp = gzopen(fn.c_str(), "r");
+    auto start = std::chrono::steady_clock::now();
+    kseq_t *seq = kseq_init(fp);
+    while (kseq_read(seq) >= 0) {
+        h += seq->seq.s[seq->seq.l / 2];
+        n++;
+    }
+    double t_kseq = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    kseq_destroy(seq);
+    gzclose(fp);
+
+    fp = gzopen(fn.c_str(), "r");
+    start = std::chrono::steady_clock::now();
+    FastqScanner scanner(fp);
+    FastqRecord r;
+    int l;
+    while ((l = scanner.read(r)) >= 0) {
+        h -= r.seq[l / 2];
+        n--;
+    }
+    double t_scan = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    gzclose(fp);
+    REQUIRE(n == 0);
+    REQUIRE(h == 0);
+    return {t_kseq, t_scan};
+}
+
+TEST_CASE("FASTQ scanner throughput", "[.][benchmark]")
+{
+    std::mt19937 gen(42);
+    std::string text;
+    for (size_t i = 0; i < 400000; i++) {
+        text += randomRecord(gen, i, 100);
+    }
+    writeGz("tmp_bench.fastq.gz", text);
+    FILE* f = fopen("tmp_bench.fastq", "wb");
+    fwrite(text.data(), 1, text.size(), f);
+    fclose(f);
+
+    for (int round = 0; round < 3; round++) {
+        // gzread passes the uncompressed file through, which leaves the parsing
+        auto plain = timeReading("tmp_bench.fastq");
+        auto gz = timeReading("tmp_bench.fastq.gz");
+
+        std::vector<uint32_t> lines(text.size());
+        auto start = std::chrono::steady_clock::now();
+        size_t k = FastqScanner::newlinesKernel()(text.data(), text.size(), lines.data());
+        double t_kernel = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        start = std::chrono::steady_clock::now();
+        REQUIRE(FastqScanner::newlinesScalar(text.data(), text.size(), lines.data()) == k);
+        double t_scalar = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        printf("[bench] %zu MB uncompressed: kseq %.3fs, scanner %.3fs; gzip: kseq %.3fs, scanner %.3fs; newlines %.3fs (scalar %.3fs)\n",
+               text.size() >> 20, plain.first, plain.second, gz.first, gz.second, t_kernel, t_scalar);
+    }
+    remove("tmp_bench.fastq");
+    remove("tmp_bench.fastq.gz");
+}
@@ -4,6 +4,7 @@
 #include "KmerIndex.h"
 #include "KmerIterator.hpp"
 
+#include <random>
 #include <string>
 
 #include <stdio.h>
@@ -42,3 +43,34 @@
 //
 //     // TODO: write tests to compare actual maps
 // }
+
+TEST_CASE("On-list mask", "[onlist]")
+{
+    ProgramOptions opt;
+    KmerIndex index(opt);
+    std::mt19937 gen(11);
+    std::uniform_int_distribution<uint32_t> id(0, 120), size(0, 40);
+
+    // no D-list, a D-list numbered after the on-list, and an on-list that
+    // is not a prefix (handled without the shortcut)
+    std::vector<Roaring> onlists(3);
+    onlists[0].addRange(0, 121);
+    onlists[1].addRange(0, 100);
+    onlists[2].addRange(0, 100);
+    onlists[2].remove(42);
+    for (const auto& onlist : onlists) {
+        index.onlist_sequences = onlist;
+        index.setOnlistEnd();
+        for (int i = 0; i < 1000; i++) {
+            Roaring u;
+            for (uint32_t n = size(gen); n > 0; n--) {
+                u.add(id(gen));
+            }
+            Roaring expected = u & onlist;
+            REQUIRE(index.hasOfflist(u) == !(expected == u));
+            REQUIRE(index.maskOnlist(u) == (expected.cardinality() != u.cardinality()));
+            REQUIRE(u == expected);
+        }
+    }
+    REQUIRE(index.onlist_end == 0);
+}
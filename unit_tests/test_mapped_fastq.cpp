@@ -0,0 +1,122 @@
+#include "catch.hpp"
+
+#include "common.h"
+#include "ProcessReads.h"
+
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <zlib.h>
+
+namespace {
+
+struct Reads {
+    std::vector<std::string> seqs, quals, names, umis;
+    size_t batches = 0;
+};
+
+// reads fn through FastqSequenceReader in small batches, alternating
+// between two of them as a reader thread would
+Reads readAll(const std::string& fn, bool comments) {
+    ProgramOptions opt;
+    opt.single_end = true;
+    opt.files.push_back(fn);
+    FastqSequenceReader SR(opt);
+
+    ReadBatch batches[2] = {ReadBatch(4096), ReadBatch(4096)};
+    Reads r;
+    bool more = true;
+    while (more) {
+        ReadBatch& batch = batches[r.batches % 2];
+        more = SR.fetchSequences(batch, true, comments);
+        for (size_t i = 0; i < batch.seqs.size(); i++) {
+            r.seqs.emplace_back(batch.seqs[i].first, batch.seqs[i].second);
+            REQUIRE(batch.seqs[i].first[batch.seqs[i].second] == '\0');
+            r.quals.emplace_back(batch.quals[i].first, batch.quals[i].second);
+            r.names.emplace_back(batch.names[i].first, batch.names[i].second);
+        }
+        for (const auto& u : batch.umis) {
+            r.umis.emplace_back(u.first, u.second);
+        }
+        REQUIRE(batch.readbatch_id == (int) r.batches);
+        r.batches++;
+    }
+    return r;
+}
+
+void requireSame(const Reads& a, const Reads& b) {
+    REQUIRE(a.seqs == b.seqs);
+    REQUIRE(a.quals == b.quals);
+    REQUIRE(a.names == b.names);
+    REQUIRE(a.umis == b.umis);
+}
+
+void writeBoth(const std::string& fn, const std::string& text) {
+    std::ofstream out(fn, std::ios::out | std::ios::binary);
+    out << text;
+    out.close();
+    gzFile gz = gzopen((fn + ".gz").c_str(), "wb");
+    gzwrite(gz, text.data(), text.size());
+    gzclose(gz);
+}
+
+std::string record(std::mt19937& gen, size_t i, const std::string& comment) {
+    std::string seq(50 + gen() % 100, 'A');
+    std::string qual(seq.size(), 'I');
+    for (size_t j = 0; j < seq.size(); j++) {
+        seq[j] = "ACGTN"[gen() % 5];
+        qual[j] = '!' + gen() % 40;
+    }
+    return "@read" + std::to_string(i) + comment + "\n" + seq + "\n+\n" + qual + "\n";
+}
+
+}
+
+TEST_CASE("Mapped FASTQ reading agrees with kseq", "[fastq]")
+{
+    std::mt19937 gen(42);
+    std::string fn = "tmp_mapped.fastq";
+    std::string text;
+
+    SECTION("Four-line records") {
+        for (size_t i = 0; i < 500; i++) {
+            text += record(gen, i, (i % 3 == 0) ? " RX:Z:ACGT" + std::to_string(i) + "\tBX:Z:1" : " 1:N:0");
+        }
+        writeBoth(fn, text);
+        for (bool comments : {false, true}) {
+            Reads mapped = readAll(fn, comments);
+            Reads copied = readAll(fn + ".gz", comments);
+            REQUIRE(mapped.seqs.size() == 500);
+            REQUIRE(mapped.batches > 10);
+            requireSame(mapped, copied);
+            REQUIRE(mapped.umis.size() == (comments ? 167 : 0));
+        }
+    }
+
+    SECTION("Records kseq has to read") {
+        for (size_t i = 0; i < 200; i++) {
+            text += record(gen, i, " 1:N:0");
+        }
+        // quality wrapped over two lines, then Windows line ends
+        text += "@wrapped 1:N:0\nACGTACGTAC\n+\nIIIII\nIIIII\n";
+        for (size_t i = 200; i < 400; i++) {
+            std::string r = record(gen, i, " 1:N:0");
+            for (size_t p = 0; (p = r.find('\n', p)) != std::string::npos; p += 2) {
+                r.insert(p, "\r");
+            }
+            text += r;
+        }
+        writeBoth(fn, text);
+        for (bool comments : {false, true}) {
+            Reads mapped = readAll(fn, comments);
+            REQUIRE(mapped.seqs.size() == 401);
+            requireSame(mapped, readAll(fn + ".gz", comments));
+        }
+    }
+
+    remove(fn.c_str());
+    remove((fn + ".gz").c_str());
+}
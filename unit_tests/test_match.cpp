@@ -0,0 +1,368 @@
+#include "catch.hpp"
+
+#include "common.h"
+#include "KmerIndex.h"
+#include "MinCollector.h"
+
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <zlib.h>
+
+
+// Writes the index of opt.transfasta to opt.index
+static void buildIndex(const ProgramOptions& opt, bool kmer_filter = false)
+{
+    KmerIndex kidx(opt);
+    std::ofstream out;
+    out.open(opt.index, std::ios::out | std::ios::binary);
+    kidx.BuildTranscripts(opt, out);
+    if (kmer_filter) {
+        kidx.buildKmerFilter();
+    }
+    kidx.write(out, opt.threads);
+}
+
+static ProgramOptions matchOptions()
+{
+    ProgramOptions opt;
+    opt.k = 31;
+    opt.threads = 1;
+    opt.transfasta.push_back("../unit_tests/input/10_trans_gt_500_bp.fasta");
+    opt.index = "tmp_match.idx";
+    return opt;
+}
+
+// The index of the ten test transcripts, built and loaded for each case
+struct MatchFixture {
+    MatchFixture(bool kmer_filter = false) : opt(matchOptions()), index(opt) {
+        buildIndex(opt, kmer_filter);
+        index.load(opt);
+        remove(opt.index.c_str());
+    }
+
+    ProgramOptions opt;
+    KmerIndex index;
+};
+
+struct FilteredMatchFixture : MatchFixture {
+    FilteredMatchFixture() : MatchFixture(true) {}
+};
+
+TEST_CASE_METHOD(MatchFixture, "Unitig match agrees with k-mer jumping", "[match]")
+{
+    MinCollector tc(index, opt);
+
+    std::vector<std::string> reads {
+        "../unit_tests/input/short_reads.fastq",
+        "../unit_tests/input/r1.fastq",
+        "../unit_tests/input/r2.fastq"};
+
+    size_t n = 0;
+    for (const auto& fn : reads) {
+        gzFile fp = gzopen(fn.c_str(), "r");
+        REQUIRE(fp != nullptr);
+        kseq_t *seq = kseq_init(fp);
+        while (kseq_read(seq) >= 0) {
+            for (bool partial : {false, true}) {
+                std::vector<std::pair<const_UnitigMap<Node>, int>> v_kmer, v_unitig;
+                index.unitig_match = false;
+                index.match(seq->seq.s, seq->seq.l, v_kmer, partial);
+                index.unitig_match = true;
+                index.match(seq->seq.s, seq->seq.l, v_unitig, partial);
+                REQUIRE(tc.intersectECs(v_kmer) == tc.intersectECs(v_unitig));
+            }
+            n++;
+        }
+        kseq_destroy(seq);
+        gzclose(fp);
+    }
+    REQUIRE(n > 0);
+}
+
+TEST_CASE_METHOD(MatchFixture, "Early exit agrees with full matching", "[match]")
+{
+    MinCollector tc(index, opt);
+
+    size_t n = 0, stopped = 0;
+    for (auto fn : {"../unit_tests/input/short_reads.fastq", "../unit_tests/input/r1.fastq", "../unit_tests/input/r2.fastq"}) {
+        gzFile fp = gzopen(fn, "r");
+        REQUIRE(fp != nullptr);
+        kseq_t *seq = kseq_init(fp);
+        while (kseq_read(seq) >= 0) {
+            for (bool unitig_match : {false, true}) {
+                std::vector<std::pair<const_UnitigMap<Node>, int>> v_full, v_early;
+                index.unitig_match = unitig_match;
+                index.early_exit = false;
+                index.match(seq->seq.s, seq->seq.l, v_full);
+                index.early_exit = true;
+                index.match(seq->seq.s, seq->seq.l, v_early);
+                Roaring u = tc.intersectECs(v_full);
+                REQUIRE(tc.intersectECs(v_early) == u);
+                // a read with hits keeps them, so its pair is still ruled out
+                REQUIRE(v_early.empty() == v_full.empty());
+                stopped += v_early.size() < v_full.size();
+            }
+            n++;
+        }
+        kseq_destroy(seq);
+        gzclose(fp);
+    }
+    REQUIRE(n > 0);
+    REQUIRE(stopped > 0);
+}
+
+TEST_CASE_METHOD(FilteredMatchFixture, "K-mer Bloom filter keeps every match", "[match]")
+{
+    REQUIRE(!index.kmer_filter.empty());
+
+    // no false negatives, on either strand
+    for (const auto& um : index.dbg) {
+        for (size_t i = 0; i < um.size - index.k + 1; ++i) {
+            Kmer km = um.getUnitigKmer(i);
+            REQUIRE(index.kmer_filter.contains(km));
+            REQUIRE(index.kmer_filter.contains(km.twin()));
+        }
+    }
+
+    std::vector<std::string> reads;
+    gzFile fp = gzopen("../unit_tests/input/short_reads.fastq", "r");
+    REQUIRE(fp != nullptr);
+    kseq_t *seq = kseq_init(fp);
+    while (kseq_read(seq) >= 0) {
+        reads.emplace_back(seq->seq.s, seq->seq.l);
+    }
+    kseq_destroy(seq);
+    gzclose(fp);
+    // reads whose first k-mers miss, so the traversal starts further in
+    std::mt19937 gen(7);
+    std::uniform_int_distribution<int> base(0, 3);
+    size_t n_mapping = reads.size();
+    for (size_t i = 0; i < n_mapping; i++) {
+        std::string r(45, 'A');
+        for (auto& c : r) {
+            c = "ACGT"[base(gen)];
+        }
+        reads.push_back(r + reads[i]);
+    }
+    // and reads that should not map at all
+    for (int i = 0; i < 1000; i++) {
+        std::string r(70, 'A');
+        for (auto& c : r) {
+            c = "ACGT"[base(gen)];
+        }
+        reads.push_back(r);
+    }
+
+    MinCollector tc(index, opt);
+    for (bool unitig_match : {false, true}) {
+        index.unitig_match = unitig_match;
+        KmerBloomFilter filter;
+        std::swap(filter, index.kmer_filter);
+        std::vector<std::vector<std::pair<const_UnitigMap<Node>, int>>> unfiltered(reads.size());
+        for (size_t i = 0; i < reads.size(); i++) {
+            index.match(reads[i].c_str(), reads[i].size(), unfiltered[i]);
+        }
+        std::swap(filter, index.kmer_filter);
+
+        for (size_t i = 0; i < reads.size(); i++) {
+            std::vector<std::pair<const_UnitigMap<Node>, int>> v;
+            index.match(reads[i].c_str(), reads[i].size(), v);
+            REQUIRE(v.size() == unfiltered[i].size());
+            for (size_t j = 0; j < v.size(); j++) {
+                REQUIRE(v[j].second == unfiltered[i][j].second);
+            }
+            REQUIRE(tc.intersectECs(v) == tc.intersectECs(unfiltered[i]));
+        }
+    }
+}
+
+TEST_CASE_METHOD(MatchFixture, "EC intersection memo agrees with direct intersection", "[match]")
+{
+    std::vector<std::vector<std::pair<const_UnitigMap<Node>, int>>> v1, v2;
+    for (auto fn : {"../unit_tests/input/r1.fastq", "../unit_tests/input/r2.fastq"}) {
+        auto& v = (v1.size() == 0) ? v1 : v2;
+        gzFile fp = gzopen(fn, "r");
+        REQUIRE(fp != nullptr);
+        kseq_t *seq = kseq_init(fp);
+        while (kseq_read(seq) >= 0) {
+            v.emplace_back();
+            index.match(seq->seq.s, seq->seq.l, v.back());
+        }
+        kseq_destroy(seq);
+        gzclose(fp);
+    }
+    REQUIRE(v1.size() == v2.size());
+    REQUIRE(v1.size() > 0);
+
+    opt.ec_memo_size = 0;
+    MinCollector direct(index, opt);
+    // small enough to be emptied over and over
+    opt.ec_memo_size = 8;
+    MinCollector small(index, opt);
+    opt.ec_memo_size = 1ULL<<16;
+    MinCollector memoized(index, opt);
+
+    // twice, so the second pass is answered from the memo
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < v1.size(); i++) {
+            for (size_t j : {i, (i*7) % v1.size()}) {
+                Roaring r, r_small, r_memo;
+                int ret = direct.intersectKmers(v1[i], v2[j], false, r);
+                REQUIRE(small.intersectKmers(v1[i], v2[j], false, r_small) == ret);
+                REQUIRE(memoized.intersectKmers(v1[i], v2[j], false, r_memo) == ret);
+                REQUIRE(r_small == r);
+                REQUIRE(r_memo == r);
+                REQUIRE(memoized.intersectECs(v1[i]) == direct.intersectECs(v1[i]));
+            }
+        }
+    }
+    // the memo is per thread, so it has to be the last collector used
+    for (size_t i = 0; i < v1.size(); i++) {
+        Roaring r;
+        memoized.intersectKmers(v1[i], v2[i], false, r);
+    }
+    REQUIRE(memoized.threadMemo().size() > 0);
+}
+
+TEST_CASE_METHOD(MatchFixture, "Block lookups agree with get_leading_vals", "[match]")
+{
+    for (const auto& um : index.dbg) {
+        const Node* n = um.getData();
+        for (size_t dist = 0; dist < um.size - index.k + 1; ++dist) {
+            auto ecs = n->ec.get_leading_vals(dist);
+            REQUIRE(n->ec.num_leading(dist) == ecs.size());
+            for (size_t i = 0; i < ecs.size(); ++i) {
+                REQUIRE(n->ec.val_at(i).getIndices() == ecs[i].getIndices());
+            }
+            const auto& v_ec = n->ec[dist];
+            for (auto tr : v_ec.getIndices()) {
+                REQUIRE(v_ec.getFirst(tr) == v_ec.get(tr, true).minimum());
+            }
+        }
+        REQUIRE(n->ec.num_leading(-1) == n->ec.get_leading_vals(-1).size());
+    }
+
+    // every target of each read's EC at once, as one by one
+    MinCollector tc(index, opt);
+    gzFile fp = gzopen("../unit_tests/input/short_reads.fastq", "r");
+    REQUIRE(fp != nullptr);
+    kseq_t *seq = kseq_init(fp);
+    std::vector<std::pair<int,bool>> pos;
+    while (kseq_read(seq) >= 0) {
+        std::vector<std::pair<const_UnitigMap<Node>, int>> v;
+        index.match(seq->seq.s, seq->seq.l, v);
+        if (v.empty()) {
+            continue;
+        }
+        Roaring u = tc.intersectECs(v);
+        const_UnitigMap<Node> um = v[0].first;
+        int p = v[0].second;
+        index.findPositions(u, um.getMappedHead(), um, p, pos);
+        REQUIRE(pos.size() == u.cardinality());
+        size_t i = 0;
+        for (auto tr : u) {
+            REQUIRE(pos[i++] == index.findPosition(tr, um.getMappedHead(), um, p));
+        }
+    }
+    kseq_destroy(seq);
+    gzclose(fp);
+}
+
+TEST_CASE_METHOD(MatchFixture, "Template length from match hits", "[match]")
+{
+    gzFile fp1 = gzopen("../unit_tests/input/r1.fastq", "r");
+    gzFile fp2 = gzopen("../unit_tests/input/r2.fastq", "r");
+    REQUIRE(fp1 != nullptr);
+    REQUIRE(fp2 != nullptr);
+    kseq_t *seq1 = kseq_init(fp1);
+    kseq_t *seq2 = kseq_init(fp2);
+    size_t mapped = 0;
+    while (kseq_read(seq1) >= 0 && kseq_read(seq2) >= 0) {
+        for (bool unitig_match : {false, true}) {
+            std::vector<std::pair<const_UnitigMap<Node>, int>> v1, v2;
+            index.unitig_match = unitig_match;
+            index.match(seq1->seq.s, seq1->seq.l, v1);
+            index.match(seq2->seq.s, seq2->seq.l, v2);
+            if (v1.empty() || v2.empty()) {
+                continue;
+            }
+            int tl = index.mapPair(seq1->seq.s, seq1->seq.l, seq2->seq.s, seq2->seq.l);
+            REQUIRE(index.mapPair(v1, v2) == tl);
+            mapped += (tl > 0) ? 1 : 0;
+        }
+    }
+    REQUIRE(mapped > 0);
+    kseq_destroy(seq1);
+    kseq_destroy(seq2);
+    gzclose(fp1);
+    gzclose(fp2);
+}
+
+TEST_CASE("Unitig match on comma-free code reads", "[match]")
+{
+    // one codon per amino acid, for reads that code the protein targets
+    const std::string aas = "ACDEFGHIKLMNPQRSTVWY";
+    const char *codons[] = {"GCT", "TGT", "GAT", "GAA", "TTT", "GGT", "CAT", "ATT", "AAA", "CTT",
+                            "ATG", "AAT", "CCT", "CAA", "CGT", "TCT", "ACT", "GTT", "TGG", "TAT"};
+
+    ProgramOptions opt = matchOptions();
+    opt.aa = true;
+    opt.transfasta = {"tmp_match_aa.fa"};
+    std::mt19937 gen(11);
+    std::uniform_int_distribution<int> aa(0, aas.size()-1), base(0, 3);
+    std::vector<std::string> proteins(5);
+    std::ofstream fa(opt.transfasta[0]);
+    for (size_t t = 0; t < proteins.size(); t++) {
+        proteins[t].resize(300);
+        for (auto& c : proteins[t]) {
+            c = aas[aa(gen)];
+        }
+        fa << ">p" << t << "\n" << proteins[t] << "\n";
+    }
+    fa.close();
+    buildIndex(opt, true);
+    remove(opt.transfasta[0].c_str());
+    KmerIndex index(opt);
+    index.load(opt);
+    remove(opt.index.c_str());
+    REQUIRE(!index.kmer_filter.empty());
+    MinCollector tc(index, opt);
+    KmerBloomFilter filter;
+
+    size_t mapped = 0;
+    for (int i = 0; i < 300; i++) {
+        // 30 codons and one or two trailing bases, which the translation drops
+        const std::string& p = proteins[i % proteins.size()];
+        size_t from = std::uniform_int_distribution<size_t>(0, p.size()-30)(gen);
+        std::string r;
+        for (size_t j = from; j < from + 30; j++) {
+            r += codons[aas.find(p[j])];
+        }
+        for (int j = 0; j < 1 + i % 2; j++) {
+            r += "ACGT"[base(gen)];
+        }
+        REQUIRE(r.size() % 3 != 0);
+
+        // with and without the Bloom gate in front of the traversals
+        for (int filtered = 0; filtered < 2; filtered++) {
+            for (bool partial : {false, true}) {
+                std::vector<std::pair<const_UnitigMap<Node>, int>> v_kmer, v_unitig;
+                index.unitig_match = false;
+                index.match(r.c_str(), r.size(), v_kmer, partial, true);
+                index.unitig_match = true;
+                index.match(r.c_str(), r.size(), v_unitig, partial, true);
+                for (const auto& hit : v_unitig) {
+                    REQUIRE(hit.second + index.k <= 3 * (r.size() / 3));
+                }
+                REQUIRE(tc.intersectECs(v_kmer) == tc.intersectECs(v_unitig));
+                mapped += (partial || v_unitig.empty()) ? 0 : 1;
+            }
+            std::swap(filter, index.kmer_filter);
+        }
+    }
+    REQUIRE(mapped > 0);
+}
@@ -1,5 +1,6 @@
 #include "catch.hpp"
 
+#include <cmath>
 #include <iostream>
 #include <vector>
 
@@ -8,7 +9,7 @@
 TEST_CASE("multinomial", "[multinomial]")
 {
     std::default_random_engine generator(42);
-    std::vector<int> x {5, 5, 10, 0};
+    std::vector<uint32_t> x {5, 5, 10, 0};
     std::discrete_distribution<int> dd(x.begin(), x.end());
 
     for (auto p : dd.probabilities()) {
@@ -27,3 +28,27 @@ TEST_CASE("multinomial", "[multinomial]")
         REQUIRE(samp[3] == 0);
     }
 }
+
+TEST_CASE("multinomial binomial splitting", "[multinomial]")
+{
+    std::vector<uint32_t> x {300, 0, 100, 600};
+    Multinomial mult(x, 7);
+
+    std::vector<double> mean(x.size(), 0.0);
+    const int reps = 2000;
+    for (auto i = 0; i < reps; ++i) {
+        auto samp = mult.sample();
+        int cur_n {0};
+        for (size_t j = 0; j < samp.size(); ++j) {
+            cur_n += samp[j];
+            mean[j] += samp[j];
+        }
+
+        REQUIRE(cur_n == mult.n());
+        REQUIRE(samp[1] == 0);
+    }
+
+    for (size_t j = 0; j < x.size(); ++j) {
+        REQUIRE(std::abs(mean[j] / reps - x[j]) < 5.0);
+    }
+}
@@ -0,0 +1,128 @@
+#include "catch.hpp"
+
+#include "ParallelGzip.h"
+
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+namespace {
+
+std::string randomFastq(size_t nreads) {
+    std::mt19937 gen(42);
+    std::string s;
+    for (size_t i = 0; i < nreads; i++) {
+        std::string seq(100, 'A');
+        for (auto& c : seq) {
+            c = "ACGT"[gen() & 3];
+        }
+        s += "@read" + std::to_string(i) + "\n" + seq + "\n+\n" + std::string(100, 'I') + "\n";
+    }
+    return s;
+}
+
+// windowBits as for deflateInit2, 31 for a gzip member and -15 for raw deflate
+std::string deflateString(const std::string& s, int windowBits) {
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    deflateInit2(&z, 6, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY);
+    std::string out(deflateBound(&z, s.size()) + 32, '\0');
+    z.next_in = (Bytef*) s.data();
+    z.avail_in = s.size();
+    z.next_out = (Bytef*) &out[0];
+    z.avail_out = out.size();
+    deflate(&z, Z_FINISH);
+    out.resize(z.total_out);
+    deflateEnd(&z);
+    return out;
+}
+
+std::string bgzfBlock(const std::string& s) {
+    std::string d = deflateString(s, -15);
+    uint16_t bsize = d.size() + 25;
+    unsigned char h[18] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0,
+                           (unsigned char) (bsize & 0xff), (unsigned char) (bsize >> 8)};
+    uint32_t t[2] = {(uint32_t) crc32(0, (const Bytef*) s.data(), s.size()), (uint32_t) s.size()};
+    return std::string((char*) h, sizeof(h)) + d + std::string((char*) t, sizeof(t));
+}
+
+void writeFile(const std::string& fn, const std::string& s) {
+    std::ofstream out(fn, std::ios::out | std::ios::binary);
+    out.write(s.data(), s.size());
+}
+
+std::string readAll(const std::string& fn, int threads, bool& parallel) {
+    std::unique_ptr<ParallelGzip> inflater;
+    gzFile f = ParallelGzip::open(fn, threads, inflater);
+    parallel = (inflater != nullptr);
+    std::string s;
+    char buf[1<<16];
+    int n;
+    while ((n = gzread(f, buf, sizeof(buf))) > 0) {
+        s.append(buf, n);
+    }
+    gzclose(f);
+    inflater.reset();
+    return s;
+}
+
+}
+
+TEST_CASE("Parallel gzip reading agrees with gzread", "[gzip]")
+{
+    std::string text = randomFastq(40000); // about 9MB
+    std::string fn = "tmp_parallel.fq.gz";
+    bool parallel;
+
+    SECTION("BGZF") {
+        std::string gz;
+        for (size_t i = 0; i < text.size(); i += 65280) {
+            gz += bgzfBlock(text.substr(i, 65280));
+        }
+        gz += bgzfBlock("");
+        writeFile(fn, gz);
+        REQUIRE(readAll(fn, 3, parallel) == text);
+        REQUIRE(parallel);
+    }
+
+    SECTION("Multi-member") {
+        std::string gz;
+        for (size_t i = 0; i < text.size(); i += 3000000) {
+            gz += deflateString(text.substr(i, 3000000), 31);
+        }
+        writeFile(fn, gz);
+        REQUIRE(readAll(fn, 3, parallel) == text);
+        REQUIRE(parallel);
+        REQUIRE(readAll(fn, 1, parallel) == text);
+        REQUIRE(!parallel);
+    }
+
+    SECTION("Single member with an index") {
+        writeFile(fn, deflateString(text, 31));
+        REQUIRE(readAll(fn, 3, parallel) == text);
+        REQUIRE(!parallel);
+
+        REQUIRE(ParallelGzip::buildIndex(fn, 1<<20));
+        REQUIRE(readAll(fn, 3, parallel) == text);
+        REQUIRE(parallel);
+
+        // an index of some other file is ignored
+        writeFile(fn, deflateString(text.substr(1000), 31));
+        REQUIRE(readAll(fn, 3, parallel) == text.substr(1000));
+        REQUIRE(!parallel);
+        remove((fn + ".kzi").c_str());
+    }
+
+    SECTION("Uncompressed") {
+        writeFile(fn, text);
+        REQUIRE(readAll(fn, 3, parallel) == text);
+        REQUIRE(!parallel);
+    }
+
+    remove(fn.c_str());
+}
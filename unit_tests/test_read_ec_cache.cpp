@@ -0,0 +1,44 @@
+#include "catch.hpp"
+
+#include <string>
+
+#include "ProcessReads.h"
+
+TEST_CASE("read ec cache", "[ec_cache]")
+{
+    ReadECCache cache(4);
+    int32_t ec = -2;
+
+    std::string r1 = "ACGTACGTAC", r2 = "TTGCA";
+    REQUIRE(!cache.find(r1.c_str(), r1.size(), r2.c_str(), r2.size(), 0, ec));
+    cache.insert(7);
+    REQUIRE(cache.find(r1.c_str(), r1.size(), r2.c_str(), r2.size(), 0, ec));
+    REQUIRE(ec == 7);
+
+    // the same bases split differently between the mates, the single
+    // read and a different tag are all different keys
+    std::string s1 = "ACGTACGTACT", s2 = "TGCA";
+    REQUIRE(!cache.find(s1.c_str(), s1.size(), s2.c_str(), s2.size(), 0, ec));
+    REQUIRE(!cache.find(r1.c_str(), r1.size(), nullptr, 0, 0, ec));
+    REQUIRE(!cache.find(r1.c_str(), r1.size(), r2.c_str(), r2.size(), 1, ec));
+
+    // unmapped reads are cached as -1
+    cache.insert(-1);
+    REQUIRE(cache.find(r1.c_str(), r1.size(), r2.c_str(), r2.size(), 1, ec));
+    REQUIRE(ec == -1);
+
+    REQUIRE(cache.hits == 2);
+    REQUIRE(cache.misses == 4);
+
+    cache.clear();
+    REQUIRE(!cache.find(r1.c_str(), r1.size(), r2.c_str(), r2.size(), 1, ec));
+}
+
+TEST_CASE("read ec cache capacity", "[ec_cache]")
+{
+    // --ec-cache-size=0 leaves the cache empty, other sizes round up
+    REQUIRE(ReadECCache(0).capacity() == 0);
+    REQUIRE(ReadECCache(1).capacity() == 1);
+    REQUIRE(ReadECCache(5).capacity() == 8);
+    REQUIRE(ReadECCache(1ULL<<14).capacity() == 1ULL<<14);
+}
@@ -0,0 +1,68 @@
+#include "catch.hpp"
+
+#include <random>
+#include <vector>
+
+#include "SmallEC.hpp"
+
+static Roaring randomSet(std::mt19937& gen, size_t n, uint32_t base)
+{
+    Roaring r;
+    std::uniform_int_distribution<uint32_t> id(base, base + 2*n + 1);
+    while (r.cardinality() < n) {
+        r.add(id(gen));
+    }
+    return r;
+}
+
+TEST_CASE("small ec intersection", "[small_ec]")
+{
+    std::vector<SmallEC::Kernel> kernels {SmallEC::intersectScalar, SmallEC::intersectKernel()};
+#ifdef KALLISTO_SMALL_EC_X86
+    kernels.push_back(SmallEC::intersectSSE2);
+#endif
+
+    std::mt19937 gen(3);
+    std::uniform_int_distribution<size_t> size(0, SmallEC::capacity);
+    for (int i = 0; i < 2000; i++) {
+        // ids around 65536 span two Roaring containers
+        uint32_t base = (i % 2 == 0) ? 10 : 65500;
+        Roaring a = randomSet(gen, size(gen), base), b = randomSet(gen, size(gen), base);
+        Roaring expected = a & b;
+
+        SmallEC sa, sb;
+        REQUIRE(sa.assign(a));
+        REQUIRE(sb.assign(b));
+        for (auto kernel : kernels) {
+            uint32_t out[SmallEC::capacity];
+            size_t n = kernel(sa.begin(), sa.size(), sb.begin(), out);
+            REQUIRE(Roaring(n, out) == expected);
+        }
+
+        sa.intersect(sb);
+        Roaring r;
+        sa.toRoaring(r);
+        REQUIRE(r == expected);
+        // the padding is restored, so the set can be reused
+        REQUIRE(sa.assign(b));
+        sa.intersect(sb);
+        REQUIRE(sa.size() == b.cardinality());
+
+        Roaring u = a;
+        SmallEC::mask(u, b);
+        REQUIRE(u == expected);
+    }
+
+    Roaring large;
+    large.addRange(0, SmallEC::capacity + 1);
+    SmallEC s;
+    REQUIRE(!s.assign(large));
+    REQUIRE(s.empty());
+    Roaring u = large;
+    Roaring odd;
+    for (uint32_t i = 1; i < 100; i += 2) {
+        odd.add(i);
+    }
+    SmallEC::mask(u, odd);
+    REQUIRE(u == (large & odd));
+}